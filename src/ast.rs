@@ -1,11 +1,11 @@
 use crate::span::{Span, Spanned};
 
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Hash)]
 pub(crate) struct Block<T> {
     pub(crate) ts: Vec<T>,
 }
 
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Hash)]
 pub(crate) enum Statement {
     Import(Spanned<String>, Option<Spanned<String>>),
     Struct(Spanned<String>, Block<Variable>),
@@ -14,38 +14,99 @@ pub(crate) enum Statement {
         Vec<Variable>,
         Spanned<Type>,
         Block<Statement>,
+        bool, // async
+        Vec<Attribute>,
     ),
+    For(Spanned<String>, Expression, Block<Statement>, LoopHints),
     Expression(Expression),
 }
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Hash)]
 pub(crate) enum Expression {
     Identifier(Spanned<String>),
+    Integer(Spanned<String>),
+    String(Spanned<String>),
+    // start..end, the integers from start up to but excluding end.
+    Range(Spanned<Box<Expression>>, Spanned<Box<Expression>>),
     Call(Spanned<Box<Expression>>, Vec<Spanned<Expression>>),
     Access(Spanned<Box<Expression>>, Spanned<Box<Expression>>),
+    Await(Spanned<Box<Expression>>),
+    Reference(Spanned<Box<Expression>>),
+    MutableReference(Spanned<Box<Expression>>),
 }
 
 impl Expression {
     pub(crate) fn span(&self) -> Span {
         match self {
             Expression::Identifier(id) => id.1.clone(),
+            Expression::Integer(integer) => integer.1.clone(),
+            Expression::String(string) => string.1.clone(),
+            Expression::Range(start, _) => start.1.clone(),
             Expression::Call(callee, _) => callee.1.clone(),
             Expression::Access(expr, _) => expr.1.clone(),
+            Expression::Await(expr) => expr.1.clone(),
+            Expression::Reference(expr) => expr.1.clone(),
+            Expression::MutableReference(expr) => expr.1.clone(),
         }
     }
 }
 
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Hash)]
 pub(crate) enum Type {
     Unit,
     Int,
     Float,
     Reference(Box<Type>),
     MutableReference(Box<Type>),
+    Pointer(Box<Type>),
+    MutablePointer(Box<Type>),
+    Slice(Box<Type>),
+    MutableSlice(Box<Type>),
+    Array(Box<Type>, ArrayLength),
+    Vector(Box<Type>, usize),
     Id(String),
     Polymorphic(String, Vec<Spanned<Type>>),
+    // A compile-time integer passed as a generic argument, as in Matrix[f32, 3].
+    Constant(usize),
 }
 
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Hash)]
+pub(crate) enum ArrayLength {
+    Literal(usize),
+    // A const generic parameter or a named constant.
+    Constant(String),
+}
+
+// What a loop's attributes ask of the optimizer: @unroll unrolls
+// completely (the trip count must be a compile-time constant) and
+// @unroll(N) by a factor of N; @vectorize forces vectorization, optionally
+// at a given width, and @no_vectorize forbids it.
+#[derive(Debug, Clone, Default, Hash)]
+pub(crate) struct LoopHints {
+    pub(crate) unroll: Option<Unroll>,
+    pub(crate) vectorize: Option<Vectorize>,
+}
+
+#[derive(Debug, Clone, Hash)]
+pub(crate) enum Unroll {
+    Full,
+    Times(usize),
+}
+
+#[derive(Debug, Clone, Hash)]
+pub(crate) enum Vectorize {
+    Width(Option<usize>),
+    Never,
+}
+
+// @name or @name(arg, ...), where each argument is an identifier or an
+// integer literal.
+#[derive(Debug, Clone, Hash)]
+pub(crate) struct Attribute {
+    pub(crate) name: Spanned<String>,
+    pub(crate) args: Vec<Spanned<String>>,
+}
+
+#[derive(Debug, Clone, Hash)]
 pub(crate) struct Variable {
     pub(crate) name: Spanned<String>,
     pub(crate) ty: Spanned<Type>,
@@ -0,0 +1,480 @@
+use std::collections::HashSet;
+
+use crate::{
+    ast::{Block, Expression, Statement, Type, Variable},
+    error::{Error, Result},
+    span::Span,
+};
+
+// What the backend may assume about a reference parameter, mirroring the
+// LLVM parameter attributes of the same names.
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub(crate) struct ParamAttributes {
+    // Nothing else accessed during the call aliases the pointee.
+    pub(crate) noalias: bool,
+    // The pointee is not written through this parameter.
+    pub(crate) readonly: bool,
+    // The reference doesn't outlive the call.
+    pub(crate) nocapture: bool,
+}
+
+// Rejects arguments that borrow overlapping places when at least one of the
+// borrows is `&mut`, e.g. f(&mut a, &a.b). Passing a reference parameter on
+// by value reborrows it with the mutability of its type, so f(p, p) is
+// rejected when `p` is a `&mut T`. With that ruled out, a `&mut T`
+// parameter is the only way the callee can reach its pointee and a `&T`
+// parameter's pointee can't change during the call, unless it holds an
+// atomic.
+pub(crate) fn check(statements: &[Statement]) -> Result<()> {
+    check_statements(statements, &[])
+}
+
+// `params` are the parameters of the enclosing function still in scope.
+fn check_statements(statements: &[Statement], params: &[Variable]) -> Result<()> {
+    for statement in statements {
+        check_statement(statement, params)?;
+    }
+    Ok(())
+}
+
+fn check_statement(statement: &Statement, params: &[Variable]) -> Result<()> {
+    match statement {
+        Statement::Function(_, params, _, body, ..) => check_statements(&body.ts, params),
+        Statement::For(name, iterable, body, _) => {
+            check_expression(iterable, params)?;
+            // The loop variable shadows a parameter of the same name.
+            let params: Vec<Variable> = params
+                .iter()
+                .filter(|param| param.name.0 != name.0)
+                .cloned()
+                .collect();
+            check_statements(&body.ts, &params)
+        }
+        Statement::Expression(expr) => check_expression(expr, params),
+        Statement::Import(..) | Statement::Struct(..) => Ok(()),
+    }
+}
+
+fn check_expression(expr: &Expression, params: &[Variable]) -> Result<()> {
+    match expr {
+        Expression::Identifier(_) | Expression::Integer(_) | Expression::String(_) => Ok(()),
+        Expression::Range(start, end) => {
+            check_expression(&start.0, params)?;
+            check_expression(&end.0, params)
+        }
+        Expression::Call(callee, args) => {
+            check_expression(&callee.0, params)?;
+            check_arguments(vec![], args, params)
+        }
+        Expression::Access(base, member) => {
+            check_expression(&base.0, params)?;
+            match method_call(place(&base.0), &member.0) {
+                // The method's `self` mode isn't resolved yet, so the
+                // receiver counts as a shared borrow: it conflicts with any
+                // `&mut` argument that overlaps it.
+                Some((receiver, args)) => {
+                    let receiver = receiver.map(|path| (path, false));
+                    check_arguments(receiver.into_iter().collect(), args, params)
+                }
+                None => check_expression(&member.0, params),
+            }
+        }
+        Expression::Await(expr)
+        | Expression::Reference(expr)
+        | Expression::MutableReference(expr) => check_expression(&expr.0, params),
+    }
+}
+
+// Checks the borrows among a call's arguments, and against `borrows`
+// already taken for the call, such as the receiver of a method.
+fn check_arguments(
+    mut borrows: Vec<(Vec<String>, bool)>,
+    args: &[(Expression, Span)],
+    params: &[Variable],
+) -> Result<()> {
+    for (arg, _) in args {
+        check_expression(arg, params)?;
+        let (path, mutable, span) = match arg {
+            Expression::Reference(inner) => (place(&inner.0), false, &inner.1),
+            Expression::MutableReference(inner) => (place(&inner.0), true, &inner.1),
+            Expression::Identifier((name, span)) => {
+                let param = params.iter().find(|param| param.name.0 == *name);
+                match param.map(|param| &param.ty.0) {
+                    Some(Type::Reference(_)) => (Some(vec![name.clone()]), false, span),
+                    Some(Type::MutableReference(_)) => (Some(vec![name.clone()]), true, span),
+                    _ => continue,
+                }
+            }
+            _ => continue,
+        };
+        // Borrows of temporaries can't conflict with anything.
+        let Some(path) = path else {
+            continue;
+        };
+        for (other, other_mutable) in &borrows {
+            if !(mutable || *other_mutable) || !overlaps(&path, other) {
+                continue;
+            }
+            let message = if mutable && *other_mutable {
+                format!(
+                    "Cannot borrow `{}` as mutable more than once in the same call",
+                    path.join(".")
+                )
+            } else {
+                format!(
+                    "Cannot borrow `{}` as {} while it is also borrowed as {}",
+                    path.join("."),
+                    if mutable { "mutable" } else { "immutable" },
+                    if mutable { "immutable" } else { "mutable" },
+                )
+            };
+            return Err(Error::new(message, span.clone()));
+        }
+        borrows.push((path, mutable));
+    }
+    Ok(())
+}
+
+// If `member`, accessed on a base whose place is `base`, ends in a method
+// call, as `b.c(args)` in a.b.c(args), returns the receiver's place (a.b)
+// and the arguments.
+fn method_call(
+    base: Option<Vec<String>>,
+    member: &Expression,
+) -> Option<(Option<Vec<String>>, &[(Expression, Span)])> {
+    match member {
+        Expression::Call(_, args) => Some((base, args)),
+        Expression::Access(field, member) => {
+            let base = match (base, place(&field.0)) {
+                (Some(mut base), Some(field)) => {
+                    base.extend(field);
+                    Some(base)
+                }
+                _ => None,
+            };
+            method_call(base, &member.0)
+        }
+        _ => None,
+    }
+}
+
+// The variable and field path an expression names, such as ["a", "b"] for
+// a.b, or None if it produces a temporary.
+fn place(expr: &Expression) -> Option<Vec<String>> {
+    match expr {
+        Expression::Identifier((name, _)) => Some(vec![name.clone()]),
+        Expression::Access(base, member) => {
+            let mut path = place(&base.0)?;
+            path.extend(place(&member.0)?);
+            Some(path)
+        }
+        _ => None,
+    }
+}
+
+// a.b overlaps a and a.b.c, but not a.c.
+fn overlaps(a: &[String], b: &[String]) -> bool {
+    a.iter().zip(b).all(|(a, b)| a == b)
+}
+
+// `shared_mutable` is the set from `shared_mutable`: a `&T` parameter whose
+// `T` can be written through a shared reference gets neither noalias nor
+// readonly, since another thread may write it during the call.
+pub(crate) fn param_attributes(
+    params: &[Variable],
+    return_ty: &Type,
+    body: &Block<Statement>,
+    is_async: bool,
+    shared_mutable: &HashSet<String>,
+) -> Vec<ParamAttributes> {
+    // An async function's parameters live in the frame it returns, and a
+    // return type that can hold a borrow may hand one back.
+    let may_return_borrow = is_async || can_hold_borrow(return_ty);
+    params
+        .iter()
+        .map(|param| {
+            let (noalias, readonly) = match &param.ty.0 {
+                Type::MutableReference(_) => (true, false),
+                Type::Reference(ty) if contains_shared_mutable(ty, shared_mutable) => {
+                    (false, false)
+                }
+                Type::Reference(_) => (true, true),
+                _ => return ParamAttributes::default(),
+            };
+            ParamAttributes {
+                noalias,
+                readonly,
+                nocapture: !may_return_borrow && !passes_on(&body.ts, &param.name.0),
+            }
+        })
+        .collect()
+}
+
+// The types that may be written through a shared reference: `Atomic`, and
+// every struct in `files` that stores one inline, directly or through other
+// such structs.
+pub(crate) fn shared_mutable(files: &[(String, Vec<Statement>)]) -> HashSet<String> {
+    let mut names: HashSet<String> = HashSet::from(["Atomic".to_string()]);
+    let mut changed = true;
+    while changed {
+        changed = false;
+        for (_, statements) in files {
+            for statement in statements {
+                let Statement::Struct(name, fields) = statement else {
+                    continue;
+                };
+                if !names.contains(&name.0)
+                    && fields
+                        .ts
+                        .iter()
+                        .any(|field| contains_shared_mutable(&field.ty.0, &names))
+                {
+                    names.insert(name.0.clone());
+                    changed = true;
+                }
+            }
+        }
+    }
+    names
+}
+
+// Whether a value of type `ty` stores one of `names` inline. Generic
+// arguments count, since a generic struct may store them inline, as
+// CachePadded[Atomic[uint]] does. References and pointers only point at
+// other memory.
+pub(crate) fn contains_shared_mutable(ty: &Type, names: &HashSet<String>) -> bool {
+    match ty {
+        Type::Id(name) => names.contains(name),
+        Type::Polymorphic(name, args) => {
+            names.contains(name)
+                || args
+                    .iter()
+                    .any(|(arg, _)| contains_shared_mutable(arg, names))
+        }
+        Type::Array(element, _) => contains_shared_mutable(element, names),
+        _ => false,
+    }
+}
+
+fn can_hold_borrow(ty: &Type) -> bool {
+    match ty {
+        Type::Unit | Type::Int | Type::Float | Type::Vector(..) | Type::Constant(_) => false,
+        Type::Array(element, _) => can_hold_borrow(element),
+        Type::Id(name) => !matches!(
+            name.as_str(),
+            "bool"
+                | "i8"
+                | "i16"
+                | "i32"
+                | "i64"
+                | "u8"
+                | "u16"
+                | "u32"
+                | "u64"
+                | "f32"
+                | "f64"
+                | "uint"
+        ),
+        _ => true,
+    }
+}
+
+// Whether anything rooted at `name` is handed to another function, which
+// could keep it: `name` itself, a field of it, a borrow of either, or a
+// receiver of a method call. Reading and writing through it don't count.
+fn passes_on(statements: &[Statement], name: &str) -> bool {
+    statements.iter().any(|statement| match statement {
+        Statement::Function(_, _, _, body, ..) => passes_on(&body.ts, name),
+        Statement::For(_, iterable, body, _) => {
+            passes_on_expression(iterable, name) || passes_on(&body.ts, name)
+        }
+        Statement::Expression(expr) => passes_on_expression(expr, name),
+        Statement::Import(..) | Statement::Struct(..) => false,
+    })
+}
+
+fn passes_on_expression(expr: &Expression, name: &str) -> bool {
+    match expr {
+        Expression::Identifier(_) | Expression::Integer(_) | Expression::String(_) => false,
+        Expression::Range(start, end) => {
+            passes_on_expression(&start.0, name) || passes_on_expression(&end.0, name)
+        }
+        Expression::Call(callee, args) => {
+            passes_on_expression(&callee.0, name) || passes_on_arguments(args, name)
+        }
+        Expression::Access(base, member) => {
+            passes_on_expression(&base.0, name)
+                || passes_on_member(&member.0, name, rooted(&base.0, name))
+        }
+        Expression::Await(expr)
+        | Expression::Reference(expr)
+        | Expression::MutableReference(expr) => passes_on_expression(&expr.0, name),
+    }
+}
+
+fn passes_on_arguments(args: &[(Expression, Span)], name: &str) -> bool {
+    args.iter()
+        .any(|(arg, _)| rooted(arg, name) || passes_on_expression(arg, name))
+}
+
+// `member` of an access whose base is rooted at `name` if `receiver` is
+// set. A method call anywhere along it takes the base as its receiver.
+fn passes_on_member(member: &Expression, name: &str, receiver: bool) -> bool {
+    match member {
+        Expression::Identifier(_) => false,
+        Expression::Call(_, args) => receiver || passes_on_arguments(args, name),
+        Expression::Access(field, member) => {
+            passes_on_member(&field.0, name, receiver)
+                || passes_on_member(&member.0, name, receiver)
+        }
+        _ => passes_on_expression(member, name),
+    }
+}
+
+// Whether `expr` is a place rooted at `name`, or a borrow of one: `name`,
+// `name.field`, `&mut name.field` and so on.
+fn rooted(expr: &Expression, name: &str) -> bool {
+    let expr = match expr {
+        Expression::Reference(inner) | Expression::MutableReference(inner) => &*inner.0,
+        _ => expr,
+    };
+    place(expr).map_or(false, |path| path[0] == name)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashSet;
+
+    use super::{check, param_attributes, shared_mutable, ParamAttributes};
+    use crate::{ast::Statement, parser::tests::parse};
+
+    // Whether `p` in `fn f(p: &mut Pending)` with `body` gets nocapture.
+    fn nocapture(body: &str) -> bool {
+        let source = format!("fn f(p: &mut Pending):\n    {}\n", body);
+        let Ok(statements) = parse(&source) else {
+            panic!("parse failed");
+        };
+        let Statement::Function(_, params, ty, body, is_async, _) = &statements[0] else {
+            panic!("expecting a function");
+        };
+        param_attributes(params, &ty.0, body, *is_async, &HashSet::new())[0].nocapture
+    }
+
+    // The attributes of the last function in `source`'s first parameter.
+    fn attributes(source: &str) -> ParamAttributes {
+        let Ok(statements) = parse(source) else {
+            panic!("parse failed");
+        };
+        let shared = shared_mutable(&[("test.velocity".to_string(), statements.clone())]);
+        let Some(Statement::Function(_, params, ty, body, is_async, _)) = statements.last() else {
+            panic!("expecting a function");
+        };
+        param_attributes(params, &ty.0, body, *is_async, &shared)[0]
+    }
+
+    fn accepts(call: &str) -> bool {
+        accepts_in("fn f():", call)
+    }
+
+    fn accepts_in(signature: &str, call: &str) -> bool {
+        let source = format!("{}\n    {}\n", signature, call);
+        let Ok(statements) = parse(&source) else {
+            panic!("parse failed");
+        };
+        check(&statements).is_ok()
+    }
+
+    #[test]
+    fn reads_do_not_capture() {
+        assert!(nocapture("p.field"));
+        assert!(nocapture("io.println(1)"));
+    }
+
+    #[test]
+    fn passing_the_parameter_captures() {
+        assert!(!nocapture("keep(p)"));
+        assert!(!nocapture("keep(&mut p)"));
+    }
+
+    #[test]
+    fn passing_a_field_captures() {
+        assert!(!nocapture("keep(p.field)"));
+        assert!(!nocapture("keep(&mut p.field)"));
+        assert!(!nocapture("keep(&p.a.b)"));
+    }
+
+    #[test]
+    fn method_arguments_capture() {
+        assert!(!nocapture("p.reactor.submit(&mut p.op)"));
+        assert!(!nocapture("queue.push(&mut p.op)"));
+    }
+
+    #[test]
+    fn method_receivers_capture() {
+        assert!(!nocapture("p.stash()"));
+        assert!(!nocapture("p.reactor.submit(1)"));
+    }
+
+    #[test]
+    fn overlapping_mutable_borrows() {
+        assert!(!accepts("f(&mut a, &a.b)"));
+        assert!(!accepts("f(&mut a.b, &mut a.b.c)"));
+        assert!(accepts("f(&mut a.b, &a.c)"));
+    }
+
+    #[test]
+    fn receiver_overlaps_mutable_argument() {
+        assert!(!accepts("a.push(&mut a)"));
+        assert!(!accepts("a.b.push(&mut a.b.c)"));
+        assert!(accepts("p.reactor.submit(&mut p.op)"));
+        assert!(accepts("a.get(&a.b)"));
+    }
+
+    #[test]
+    fn shared_references() {
+        let attributes = attributes("fn f(p: &Point):\n    p.x\n");
+        assert!(attributes.noalias && attributes.readonly);
+    }
+
+    #[test]
+    fn shared_references_to_atomics() {
+        for source in [
+            "fn f(flag: &Atomic[bool]):\n    flag.load()\n",
+            "struct Task:\n    done: Atomic[bool]\n\nfn f(task: &Task):\n    task.is_done()\n",
+            "struct Side:\n    index: Atomic[uint]\n\nstruct Ring:\n    producer: CachePadded[Side]\n\nfn f(ring: &Ring):\n    ring.len()\n",
+            "fn f(flags: &[Atomic[bool]; 4]):\n    flags\n",
+        ] {
+            let attributes = attributes(source);
+            assert!(!attributes.noalias && !attributes.readonly, "{}", source);
+        }
+    }
+
+    #[test]
+    fn pointers_to_atomics_are_not_stored_inline() {
+        let source =
+            "struct Handle:\n    flag: *Atomic[bool]\n\nfn f(handle: &Handle):\n    handle.flag\n";
+        let attributes = attributes(source);
+        assert!(attributes.noalias && attributes.readonly);
+    }
+
+    #[test]
+    fn reference_parameters_passed_on() {
+        let signature = "fn f(p: &mut Pending, q: &Pending, n: int):";
+        assert!(!accepts_in(signature, "g(p, p)"));
+        assert!(!accepts_in(signature, "g(p, &p.op)"));
+        assert!(!accepts_in(signature, "g(&mut q, q)"));
+        assert!(!accepts_in(signature, "p.submit(p)"));
+        assert!(accepts_in(signature, "g(p, q)"));
+        assert!(accepts_in(signature, "g(q, q)"));
+        assert!(accepts_in(signature, "g(n, n)"));
+    }
+
+    #[test]
+    fn loop_variables_shadow_parameters() {
+        let source = "fn f(p: &mut Pending):\n    for p in 0..4:\n        g(p, p)\n";
+        let Ok(statements) = parse(source) else {
+            panic!("parse failed");
+        };
+        assert!(check(&statements).is_ok());
+    }
+}
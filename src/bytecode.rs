@@ -0,0 +1,587 @@
+use std::{collections::HashMap, fmt::Display, sync::Arc};
+
+use crate::{
+    ast::{Expression, Statement, Variable},
+    error::{Error, Result},
+    span::Span,
+};
+
+// Index of a function in the interpreter's function table.
+pub(crate) type FunctionId = usize;
+
+// A slot in the current call frame. A function's parameters arrive in the
+// first registers, in order.
+pub(crate) type Register = u16;
+
+#[derive(Debug, Clone)]
+pub(crate) enum Instruction {
+    LoadUnit(Register),
+    LoadInt(Register, i64),
+    // Loads an entry of the function's `strings`.
+    LoadString(Register, u32),
+    Move(Register, Register),
+    // Calls a function with the arguments in `count` registers starting at
+    // `base`, and stores its result in `base`.
+    Call(FunctionId, Register, u16),
+    // println (true) or print (false): the format string in `base`, then
+    // `count` arguments.
+    Print(Register, u16, bool),
+    // Jumps to the target unless the first register is less than the
+    // second.
+    JumpIfNotLess(Register, Register, u32),
+    Increment(Register),
+    // Jumps back to a loop's condition.
+    Loop(u32),
+    // Increments the first register and jumps to the target, the start of
+    // the loop body, if it's still less than the second. Replaces a loop's
+    // Increment and Loop in optimized code, so each iteration takes one
+    // dispatch and no type check.
+    ForLoop(Register, Register, u32),
+    Return,
+}
+
+#[derive(Debug)]
+pub(crate) struct Function {
+    pub(crate) name: String,
+    pub(crate) registers: usize,
+    pub(crate) code: Vec<Instruction>,
+    // The source of each instruction, for errors at run time.
+    pub(crate) spans: Vec<Span>,
+    pub(crate) strings: Vec<Arc<str>>,
+}
+
+#[derive(Debug, Clone)]
+pub(crate) enum Value {
+    Unit,
+    Int(i64),
+    Str(Arc<str>),
+}
+
+impl Display for Value {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Value::Unit => write!(f, "()"),
+            Value::Int(value) => write!(f, "{}", value),
+            Value::Str(value) => write!(f, "{}", value),
+        }
+    }
+}
+
+// Rewrites a function for the optimized tier. Fuses each loop's
+// back-edge into a ForLoop, and drops writes to registers nothing reads,
+// such as the unit result of a call used as a statement.
+pub(crate) fn optimize(function: &Function) -> Function {
+    let mut code = function.code.clone();
+    let mut keep = vec![true; code.len()];
+
+    for pc in 1..code.len() {
+        let Instruction::Loop(condition) = code[pc] else {
+            continue;
+        };
+        let condition = condition as usize;
+        if let (Instruction::Increment(_), Instruction::JumpIfNotLess(index, limit, _)) =
+            (&code[pc - 1], &code[condition])
+        {
+            code[pc - 1] = Instruction::ForLoop(*index, *limit, condition as u32 + 1);
+            keep[pc] = false;
+        }
+    }
+
+    let mut read = vec![false; function.registers];
+    for instruction in &code {
+        let (first, count) = match instruction {
+            Instruction::Move(_, source) => (*source, 1),
+            Instruction::Call(_, base, count) => (*base, *count as usize),
+            Instruction::Print(base, count, _) => (*base, *count as usize + 1),
+            Instruction::JumpIfNotLess(a, b, _) | Instruction::ForLoop(a, b, _) => {
+                read[*b as usize] = true;
+                (*a, 1)
+            }
+            Instruction::Increment(register) => (*register, 1),
+            _ => continue,
+        };
+        for register in first as usize..first as usize + count {
+            read[register] = true;
+        }
+    }
+    for (pc, instruction) in code.iter().enumerate() {
+        if let Instruction::LoadUnit(destination)
+        | Instruction::LoadInt(destination, _)
+        | Instruction::LoadString(destination, _)
+        | Instruction::Move(destination, _) = instruction
+        {
+            if !read[*destination as usize] {
+                keep[pc] = false;
+            }
+        }
+    }
+
+    // Where each instruction ends up once the dropped ones are gone. A
+    // jump to a dropped instruction lands on the next one kept.
+    let mut moved: Vec<u32> = vec![0; code.len() + 1];
+    let mut next = 0;
+    for pc in 0..code.len() {
+        moved[pc] = next;
+        if keep[pc] {
+            next += 1;
+        }
+    }
+    moved[code.len()] = next;
+    let mut optimized = Function {
+        name: function.name.clone(),
+        registers: function.registers,
+        code: vec![],
+        spans: vec![],
+        strings: function.strings.clone(),
+    };
+    for (pc, mut instruction) in code.into_iter().enumerate() {
+        if !keep[pc] {
+            continue;
+        }
+        match &mut instruction {
+            Instruction::JumpIfNotLess(_, _, target)
+            | Instruction::Loop(target)
+            | Instruction::ForLoop(_, _, target) => *target = moved[*target as usize],
+            _ => {}
+        }
+        optimized.code.push(instruction);
+        optimized.spans.push(function.spans[pc].clone());
+    }
+    optimized
+}
+
+// Finds a top-level function by name, for its parameters.
+pub(crate) fn find_function<'a>(statements: &'a [Statement], name: &str) -> Option<&'a Statement> {
+    statements.iter().find(
+        |statement| matches!(statement, Statement::Function(function, ..) if function.0 == name),
+    )
+}
+
+// Compiles one function from file `file` to bytecode. `modules` maps each
+// file's imports to files as in `reachability::modules`, and `resolve`
+// assigns a function table entry to each function the code calls.
+pub(crate) fn lower(
+    files: &[(String, Vec<Statement>)],
+    modules: &[HashMap<String, usize>],
+    file: usize,
+    function: &Statement,
+    resolve: &mut dyn FnMut(usize, &str) -> FunctionId,
+) -> Result<Function> {
+    let Statement::Function(name, params, _, body, ..) = function else {
+        unreachable!()
+    };
+    let mut lowering = Lowering {
+        files,
+        modules: &modules[file],
+        file,
+        resolve,
+        locals: vec![],
+        next: 0,
+        registers: 0,
+        code: vec![],
+        spans: vec![],
+        strings: vec![],
+    };
+    for param in params {
+        let register = lowering.temporary();
+        lowering.locals.push((param.name.0.clone(), register));
+    }
+    lowering.statements(&body.ts)?;
+    lowering.emit(Instruction::Return, name.1.clone());
+    Ok(Function {
+        name: name.0.clone(),
+        registers: lowering.registers,
+        code: lowering.code,
+        spans: lowering.spans,
+        strings: lowering.strings,
+    })
+}
+
+struct Lowering<'a> {
+    files: &'a [(String, Vec<Statement>)],
+    modules: &'a HashMap<String, usize>,
+    file: usize,
+    resolve: &'a mut dyn FnMut(usize, &str) -> FunctionId,
+    locals: Vec<(String, Register)>,
+    // Registers below `next` are in use; `registers` is the most ever used.
+    next: usize,
+    registers: usize,
+    code: Vec<Instruction>,
+    spans: Vec<Span>,
+    strings: Vec<Arc<str>>,
+}
+
+impl Lowering<'_> {
+    fn statements(&mut self, statements: &[Statement]) -> Result<()> {
+        for statement in statements {
+            let next = self.next;
+            match statement {
+                Statement::For(name, iterable, body, _) => {
+                    let Expression::Range(start, end) = iterable else {
+                        return Err(Error::new(
+                            "Expecting a range; only ranges can be iterated yet",
+                            iterable.span(),
+                        ));
+                    };
+                    let index = self.temporary();
+                    let limit = self.temporary();
+                    self.expression(&start.0, index)?;
+                    self.expression(&end.0, limit)?;
+                    let condition = self.code.len();
+                    self.emit(Instruction::JumpIfNotLess(index, limit, 0), name.1.clone());
+                    self.locals.push((name.0.clone(), index));
+                    self.statements(&body.ts)?;
+                    self.locals.pop();
+                    self.emit(Instruction::Increment(index), name.1.clone());
+                    self.emit(Instruction::Loop(condition as u32), name.1.clone());
+                    let exit = self.code.len() as u32;
+                    self.code[condition] = Instruction::JumpIfNotLess(index, limit, exit);
+                }
+                Statement::Expression(expr) => {
+                    let register = self.temporary();
+                    self.expression(expr, register)?;
+                }
+                // Nested functions are only reachable through calls, which
+                // resolve to top-level functions.
+                Statement::Function(..) | Statement::Import(..) | Statement::Struct(..) => {}
+            }
+            self.next = next;
+        }
+        Ok(())
+    }
+
+    // Evaluates `expr` into `destination`.
+    fn expression(&mut self, expr: &Expression, destination: Register) -> Result<()> {
+        match expr {
+            Expression::Identifier((name, span)) => {
+                let Some((_, register)) = self.locals.iter().rev().find(|(local, _)| local == name)
+                else {
+                    return Err(Error::new(
+                        format!("Unknown variable `{}`", name),
+                        span.clone(),
+                    ));
+                };
+                self.emit(Instruction::Move(destination, *register), span.clone());
+            }
+            Expression::Integer((value, span)) => {
+                let Ok(value) = value.parse::<i64>() else {
+                    return Err(Error::new("Integer literal is too large", span.clone()));
+                };
+                self.emit(Instruction::LoadInt(destination, value), span.clone());
+            }
+            Expression::String((value, span)) => {
+                self.strings.push(value.as_str().into());
+                let index = self.strings.len() as u32 - 1;
+                self.emit(Instruction::LoadString(destination, index), span.clone());
+            }
+            Expression::Call(callee, args) => {
+                let Expression::Identifier((name, span)) = &*callee.0 else {
+                    return Err(Error::new("Expecting a function name", callee.1.clone()));
+                };
+                match find_function(&self.files[self.file].1, name) {
+                    Some(function) => self.call(self.file, function, args, destination, span)?,
+                    None if name == "println" || name == "print" => {
+                        self.print(args, name == "println", destination, span)?
+                    }
+                    None => {
+                        return Err(Error::new(
+                            format!("Unknown function `{}`", name),
+                            span.clone(),
+                        ))
+                    }
+                }
+            }
+            // `module.f(args)`, or io's println and print.
+            Expression::Access(base, member) => {
+                let (Expression::Identifier((module, _)), Expression::Call(callee, args)) =
+                    (&*base.0, &*member.0)
+                else {
+                    return Err(Error::new(
+                        "Expecting a module function call; fields and methods can't be run yet",
+                        base.1.clone(),
+                    ));
+                };
+                let Expression::Identifier((name, span)) = &*callee.0 else {
+                    return Err(Error::new("Expecting a function name", callee.1.clone()));
+                };
+                if let Some(&index) = self.modules.get(module) {
+                    let Some(function) = find_function(&self.files[index].1, name) else {
+                        return Err(Error::new(
+                            format!("Unknown function `{}.{}`", module, name),
+                            span.clone(),
+                        ));
+                    };
+                    self.call(index, function, args, destination, span)?;
+                } else if self.imports_io(module) && (name == "println" || name == "print") {
+                    self.print(args, name == "println", destination, span)?;
+                } else {
+                    return Err(Error::new(
+                        format!("Unknown module `{}`", module),
+                        base.1.clone(),
+                    ));
+                }
+            }
+            Expression::Range(start, _) => {
+                return Err(Error::new(
+                    "Expecting a range only as a for loop's bounds",
+                    start.1.clone(),
+                ))
+            }
+            Expression::Await(expr)
+            | Expression::Reference(expr)
+            | Expression::MutableReference(expr) => {
+                return Err(Error::new(
+                    "Expression can't be run by the interpreter yet",
+                    expr.1.clone(),
+                ))
+            }
+        }
+        Ok(())
+    }
+
+    fn call(
+        &mut self,
+        file: usize,
+        function: &Statement,
+        args: &[(Expression, Span)],
+        destination: Register,
+        span: &Span,
+    ) -> Result<()> {
+        let Statement::Function(name, params, ..) = function else {
+            unreachable!()
+        };
+        check_arity(params, args, span)?;
+        let base = self.arguments(args)?;
+        // The result goes in `base`, which needs a register of its own when
+        // there are no arguments.
+        if args.is_empty() {
+            self.temporary();
+        }
+        let id = (self.resolve)(file, &name.0);
+        self.emit(Instruction::Call(id, base, args.len() as u16), span.clone());
+        if base != destination {
+            self.emit(Instruction::Move(destination, base), span.clone());
+        }
+        Ok(())
+    }
+
+    // The format string must be a literal so its placeholders can be
+    // checked against the arguments here rather than at run time.
+    fn print(
+        &mut self,
+        args: &[(Expression, Span)],
+        newline: bool,
+        destination: Register,
+        span: &Span,
+    ) -> Result<()> {
+        let Some((Expression::String((format, _)), _)) = args.first() else {
+            return Err(Error::new("Expecting a format string", span.clone()));
+        };
+        let placeholders = format.matches("{}").count();
+        if placeholders != args.len() - 1 {
+            return Err(Error::new(
+                format!(
+                    "Expecting {} arguments for the format string, found {}",
+                    placeholders,
+                    args.len() - 1
+                ),
+                span.clone(),
+            ));
+        }
+        let base = self.arguments(args)?;
+        self.emit(
+            Instruction::Print(base, args.len() as u16 - 1, newline),
+            span.clone(),
+        );
+        self.emit(Instruction::LoadUnit(destination), span.clone());
+        Ok(())
+    }
+
+    // Evaluates arguments into consecutive fresh registers and returns the
+    // first.
+    fn arguments(&mut self, args: &[(Expression, Span)]) -> Result<Register> {
+        let base = self.next as Register;
+        for _ in args {
+            self.temporary();
+        }
+        for (i, (arg, _)) in args.iter().enumerate() {
+            self.expression(arg, base + i as Register)?;
+        }
+        Ok(base)
+    }
+
+    fn imports_io(&self, module: &str) -> bool {
+        self.files[self.file]
+            .1
+            .iter()
+            .any(|statement| match statement {
+                Statement::Import(path, alias) => {
+                    path.0 == "std/io"
+                        && alias.as_ref().map_or("io", |alias| alias.0.as_str()) == module
+                }
+                _ => false,
+            })
+    }
+
+    fn temporary(&mut self) -> Register {
+        let register = self.next as Register;
+        self.next += 1;
+        self.registers = self.registers.max(self.next);
+        register
+    }
+
+    fn emit(&mut self, instruction: Instruction, span: Span) {
+        self.code.push(instruction);
+        self.spans.push(span);
+    }
+}
+
+fn check_arity(params: &[Variable], args: &[(Expression, Span)], span: &Span) -> Result<()> {
+    if params.len() != args.len() {
+        return Err(Error::new(
+            format!("Expecting {} arguments, found {}", params.len(), args.len()),
+            span.clone(),
+        ));
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{optimize, Function, Instruction, Value};
+    use crate::{interpreter::Interpreter, parser::tests::parse};
+
+    struct Run {
+        function: Function,
+        registers: Vec<Value>,
+        out: String,
+    }
+
+    // Runs `main` as lowered and as optimized.
+    fn tiers(source: &str) -> (Run, Run) {
+        let Ok(statements) = parse(source) else {
+            panic!("parse failed");
+        };
+        let files = vec![("test.velocity".to_string(), statements)];
+        let run = |tier: &dyn Fn(&Function) -> Function| {
+            let mut out = vec![];
+            let Ok((function, registers)) = Interpreter::new(&files, &mut out).run_main_with(tier)
+            else {
+                panic!("run failed");
+            };
+            Run {
+                function,
+                registers,
+                out: String::from_utf8(out).unwrap(),
+            }
+        };
+        let baseline = run(&|function| Function {
+            name: function.name.clone(),
+            registers: function.registers,
+            code: function.code.clone(),
+            spans: function.spans.clone(),
+            strings: function.strings.clone(),
+        });
+        (baseline, run(&optimize))
+    }
+
+    fn destination(instruction: &Instruction) -> Option<usize> {
+        match instruction {
+            Instruction::LoadUnit(register)
+            | Instruction::LoadInt(register, _)
+            | Instruction::LoadString(register, _)
+            | Instruction::Move(register, _)
+            | Instruction::Call(_, register, _)
+            | Instruction::Increment(register)
+            | Instruction::ForLoop(register, ..) => Some(*register as usize),
+            _ => None,
+        }
+    }
+
+    // Both tiers print the same thing, and every register the optimized
+    // code still writes ends up the same. Registers whose writes were
+    // dropped are never read, so they may differ.
+    fn assert_same(source: &str) -> (Function, Function) {
+        let (baseline, optimized) = tiers(source);
+        assert_eq!(baseline.out, optimized.out);
+        assert_eq!(baseline.registers.len(), optimized.registers.len());
+        for (register, (a, b)) in baseline
+            .registers
+            .iter()
+            .zip(&optimized.registers)
+            .enumerate()
+        {
+            let written = optimized
+                .function
+                .code
+                .iter()
+                .any(|instruction| destination(instruction) == Some(register));
+            if written {
+                assert_eq!(format!("{:?}", a), format!("{:?}", b), "r{}", register);
+            }
+        }
+        (baseline.function, optimized.function)
+    }
+
+    fn count(function: &Function, matches: fn(&Instruction) -> bool) -> usize {
+        function
+            .code
+            .iter()
+            .filter(|instruction| matches(instruction))
+            .count()
+    }
+
+    #[test]
+    fn fuses_loops() {
+        let (baseline, optimized) = assert_same(concat!(
+            "fn main():\n",
+            "    for i in 0..3:\n",
+            "        for j in i..3:\n",
+            "            println(\"{} {}\", i, j)\n",
+            "    for k in 5..5:\n",
+            "        println(\"never {}\", k)\n",
+        ));
+        assert_eq!(count(&baseline, |i| matches!(i, Instruction::Loop(_))), 3);
+        assert_eq!(
+            count(&optimized, |i| matches!(i, Instruction::ForLoop(..))),
+            3
+        );
+        assert_eq!(
+            count(&optimized, |i| matches!(
+                i,
+                Instruction::Loop(_) | Instruction::Increment(_)
+            )),
+            0
+        );
+        // Every jump lands inside the function.
+        for instruction in &optimized.code {
+            if let Instruction::JumpIfNotLess(_, _, target) | Instruction::ForLoop(_, _, target) =
+                instruction
+            {
+                assert!((*target as usize) < optimized.code.len());
+            }
+        }
+    }
+
+    #[test]
+    fn drops_dead_writes() {
+        let (baseline, optimized) = assert_same(concat!(
+            "fn unit():\n",
+            "    print(\"\")\n",
+            "\n",
+            "fn show(a: int):\n",
+            "    println(\"{}\", a)\n",
+            "\n",
+            "fn main():\n",
+            "    unit()\n",
+            "    println(\"{}\", unit())\n",
+            "    show(1)\n",
+        ));
+        let dead = |function: &Function| {
+            count(function, |i| {
+                matches!(i, Instruction::LoadUnit(_) | Instruction::Move(..))
+            })
+        };
+        assert!(dead(&optimized) < dead(&baseline));
+    }
+}
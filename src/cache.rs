@@ -0,0 +1,120 @@
+use std::{
+    env, fs,
+    hash::{Hash, Hasher},
+    io,
+    path::PathBuf,
+    process,
+};
+
+use crate::{ast::Statement, effects::Effect, fast_math::FastMath};
+
+// Changed whenever the contents of an entry change shape, so entries
+// written in an older format are never read back.
+const FORMAT_VERSION: u64 = 1;
+
+// A directory of per-function build outputs, so a rebuild only redoes the
+// functions that changed. Each entry is a file named after its key.
+pub(crate) struct Cache {
+    dir: PathBuf,
+    compiler: u64,
+}
+
+impl Cache {
+    // Fails if the compiler's own executable can't be read, since entries
+    // are only valid for the build of the compiler that wrote them.
+    pub(crate) fn open(dir: impl Into<PathBuf>) -> io::Result<Cache> {
+        let dir = dir.into();
+        fs::create_dir_all(&dir)?;
+        let mut hasher = Fnv1a::new();
+        hasher.write(&fs::read(env::current_exe()?)?);
+        Ok(Cache {
+            dir,
+            compiler: hasher.finish(),
+        })
+    }
+
+    // Everything a function's output depends on: its own syntax tree,
+    // spans included since debug info records them, the effect inferred
+    // from its callees, which of its parameters borrow memory that can be
+    // written through a shared reference (which depends on struct
+    // definitions elsewhere), its floating-point flags, and the exact
+    // compiler build and entry format.
+    pub(crate) fn function_key(
+        &self,
+        function: &Statement,
+        effect: Effect,
+        shared_mutable_params: &[bool],
+        fast_math: FastMath,
+    ) -> u64 {
+        let mut hasher = Fnv1a::new();
+        hasher.write_u64(FORMAT_VERSION);
+        hasher.write_u64(self.compiler);
+        function.hash(&mut hasher);
+        effect.hash(&mut hasher);
+        shared_mutable_params.hash(&mut hasher);
+        fast_math.hash(&mut hasher);
+        hasher.finish()
+    }
+
+    // A missing or unreadable entry is a miss.
+    pub(crate) fn get(&self, key: u64) -> Option<Vec<u8>> {
+        fs::read(self.path(key)).ok()
+    }
+
+    // Writes to a temporary file and renames it into place, so concurrent
+    // builds sharing the directory never see a partial entry. Failing to
+    // store only costs a recompile next time, so errors are ignored.
+    pub(crate) fn put(&self, key: u64, data: &[u8]) {
+        let temporary = self.dir.join(format!("{:016x}.{}.tmp", key, process::id()));
+        if fs::write(&temporary, data).is_ok() && fs::rename(&temporary, self.path(key)).is_err() {
+            let _ = fs::remove_file(&temporary);
+        }
+    }
+
+    fn path(&self, key: u64) -> PathBuf {
+        self.dir.join(format!("{:016x}", key))
+    }
+}
+
+// 64-bit FNV-1a. Keys are stored on disk, so unlike the standard library's
+// hasher this must give the same result whichever Rust release built the
+// compiler.
+struct Fnv1a(u64);
+
+impl Fnv1a {
+    fn new() -> Fnv1a {
+        Fnv1a(0xcbf29ce484222325)
+    }
+}
+
+impl Hasher for Fnv1a {
+    fn write(&mut self, bytes: &[u8]) {
+        for byte in bytes {
+            self.0 = (self.0 ^ *byte as u64).wrapping_mul(0x100000001b3);
+        }
+    }
+
+    fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::hash::Hasher;
+
+    use super::Fnv1a;
+
+    #[test]
+    fn fnv1a_reference_values() {
+        for (input, hash) in [
+            ("", 0xcbf29ce484222325),
+            ("a", 0xaf63dc4c8601ec8c),
+            ("foobar", 0x85944171f73967e8),
+        ] {
+            let mut hasher = Fnv1a::new();
+            hasher.write(input.as_bytes());
+            assert_eq!(hasher.finish(), hash);
+        }
+    }
+}
@@ -1,14 +1,59 @@
-use std::rc::Rc;
+use std::{
+    collections::{HashMap, HashSet},
+    slice,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    thread,
+};
 
-use crate::{error::Error, parser::Parser, tokenizer::Tokenizer};
+use crate::{
+    ast::{Statement, Type},
+    borrow,
+    cache::Cache,
+    effects::{self, Effect},
+    error::Error,
+    fast_math::FastMath,
+    interpreter::Interpreter,
+    parser::Parser,
+    partition, reachability,
+    tokenizer::Tokenizer,
+};
 
 pub(crate) struct Compiler {
     files: Vec<String>,
+    fast_math: FastMath,
+    cache: Option<Cache>,
+    codegen_units: Option<usize>,
 }
 
 impl Compiler {
     pub(crate) fn new() -> Compiler {
-        Compiler { files: Vec::new() }
+        Compiler {
+            files: Vec::new(),
+            fast_math: FastMath::default(),
+            cache: None,
+            codegen_units: None,
+        }
+    }
+
+    // Relaxes floating-point semantics in every function not marked
+    // @strict_math.
+    pub(crate) fn enable_fast_math(&mut self) {
+        self.fast_math = FastMath::all();
+    }
+
+    // Reuses the output of functions that haven't changed since they were
+    // last compiled with this cache.
+    pub(crate) fn use_cache(&mut self, cache: Cache) {
+        self.cache = Some(cache);
+    }
+
+    // Splits the program into at most `units` codegen units and reports
+    // the partition.
+    pub(crate) fn set_codegen_units(&mut self, units: usize) {
+        self.codegen_units = Some(units);
     }
 
     pub(crate) fn add_file(&mut self, filename: String) {
@@ -16,32 +61,172 @@ impl Compiler {
     }
 
     pub(crate) fn compile(&self) -> Result<(), Error> {
-        for filename in &self.files {
-            let contents: String = match std::fs::read_to_string(filename.as_str()) {
-                Ok(contents) => contents,
-                Err(_) => {
-                    return Err(Error::new(
-                        format!("failed to read file '{}'", filename).as_str(),
-                        (Rc::new("<stdin>".to_string()), (0, 0)..(0, 0)),
-                    ))
-                }
-            };
-            let mut tokenizer = Tokenizer::new(Rc::new(filename.clone()), contents);
-            let tokens = match tokenizer.tokenize() {
-                Ok(tokens) => tokens,
-                Err(err) => return Err(err),
+        // Files are independent until reachability, so each one is read,
+        // tokenized and parsed on its own worker. The first error in input
+        // order wins, whichever worker finishes first.
+        let files = parallel_map(&self.files, |filename| parse_file(filename))
+            .into_iter()
+            .collect::<Result<Vec<_>, Error>>()?;
+
+        // Functions nothing reaches are dropped before any further work.
+        let reachable = reachability::reachable(&files);
+        let files: Vec<(String, Vec<Statement>)> = files
+            .into_iter()
+            .enumerate()
+            .map(|(index, (filename, statements))| {
+                let statements = statements
+                    .into_iter()
+                    .filter(|statement| match (statement, &reachable) {
+                        (Statement::Function(name, ..), Some(reachable)) => {
+                            reachable.contains(&(index, name.0.clone()))
+                        }
+                        _ => true,
+                    })
+                    .collect();
+                (filename, statements)
+            })
+            .collect();
+
+        let shared_mutable = borrow::shared_mutable(&files);
+        let effects = effects::analyze(&files)?;
+        let inputs: Vec<_> = files.iter().zip(&effects).collect();
+        let outputs = parallel_map(&inputs, |((_, statements), effects)| {
+            self.analyze(statements, effects, &shared_mutable)
+        });
+        for output in outputs {
+            print!("{}", output?);
+        }
+        if let Some(units) = self.codegen_units {
+            let names = |functions: &[(usize, String)]| {
+                functions
+                    .iter()
+                    .map(|(file, name)| format!("{}:{}", files[*file].0, name))
+                    .collect::<Vec<_>>()
+                    .join(", ")
             };
+            for (index, unit) in partition::partition(&files, units).iter().enumerate() {
+                println!(
+                    "unit {}: functions [{}] imports [{}]",
+                    index,
+                    names(&unit.functions),
+                    names(&unit.imports)
+                );
+            }
+        }
+        Ok(())
+    }
 
-            let mut parser = Parser::new(tokens);
-            let statements = match parser.parse() {
-                Ok(statements) => statements,
-                Err(err) => return Err(err),
+    // Runs the program's `main` instead of compiling it. Functions are
+    // lowered to bytecode on their first call.
+    pub(crate) fn run(&self) -> Result<(), Error> {
+        let files = parallel_map(&self.files, |filename| parse_file(filename))
+            .into_iter()
+            .collect::<Result<Vec<_>, Error>>()?;
+        let stdout = std::io::stdout();
+        if !Interpreter::new(&files, &mut stdout.lock()).run()? {
+            eprintln!("no function named 'main' to run");
+        }
+        Ok(())
+    }
+
+    // `effects` covers the whole program, since a function's effect depends
+    // on its callees and is part of its cache key. Everything else is per
+    // function and skipped for functions found in the cache, which only
+    // ever holds functions that passed these checks.
+    fn analyze(
+        &self,
+        statements: &[Statement],
+        effects: &HashMap<String, Effect>,
+        shared_mutable: &HashSet<String>,
+    ) -> Result<String, Error> {
+        let mut out = String::new();
+        for statement in statements {
+            let Statement::Function(name, params, ty, body, is_async, attributes) = statement
+            else {
+                borrow::check(slice::from_ref(statement))?;
+                out.push_str(&format!("{:?}\n", statement));
+                continue;
             };
+            let effect = effects[&name.0];
+            let fast_math = FastMath::for_function(attributes, self.fast_math)?;
+            let shared_mutable_params: Vec<bool> = params
+                .iter()
+                .map(|param| match &param.ty.0 {
+                    Type::Reference(ty) => borrow::contains_shared_mutable(ty, shared_mutable),
+                    _ => false,
+                })
+                .collect();
+            let cache = self.cache.as_ref().map(|cache| {
+                let key = cache.function_key(statement, effect, &shared_mutable_params, fast_math);
+                (cache, key)
+            });
+            if let Some(cached) = cache.and_then(|(cache, key)| cache.get(key)) {
+                out.push_str(&String::from_utf8_lossy(&cached));
+                continue;
+            }
 
-            for statement in statements {
-                println!("{:?}", statement);
+            borrow::check(slice::from_ref(statement))?;
+            let mut function = format!("{:?}\n", statement);
+            function.push_str(&format!(
+                "{:?}\n",
+                borrow::param_attributes(params, &ty.0, body, *is_async, shared_mutable)
+            ));
+            function.push_str(&format!("{:?}\n", effect));
+            function.push_str(&format!("{:?}\n", fast_math));
+            if let Some((cache, key)) = cache {
+                cache.put(key, function.as_bytes());
             }
+            out.push_str(&function);
         }
-        Ok(())
+        Ok(out)
     }
 }
+
+fn parse_file(filename: &String) -> Result<(String, Vec<Statement>), Error> {
+    let contents: String = match std::fs::read_to_string(filename.as_str()) {
+        Ok(contents) => contents,
+        Err(_) => {
+            return Err(Error::new(
+                format!("failed to read file '{}'", filename).as_str(),
+                (Arc::new("<stdin>".to_string()), (0, 0)..(0, 0)),
+            ))
+        }
+    };
+    let mut tokenizer = Tokenizer::new(Arc::new(filename.clone()), contents);
+    let tokens = tokenizer.tokenize()?;
+    let mut parser = Parser::new(tokens);
+    let statements = parser.parse()?;
+    Ok((filename.clone(), statements))
+}
+
+// Runs `f` on every item on a pool of worker threads, one per core, and
+// returns the results in the order of `items` so output never depends on
+// how the work was scheduled.
+fn parallel_map<T: Sync, R: Send>(items: &[T], f: impl Fn(&T) -> R + Sync) -> Vec<R> {
+    let workers = thread::available_parallelism()
+        .map_or(1, |n| n.get())
+        .min(items.len());
+    let next = AtomicUsize::new(0);
+    let mut results: Vec<(usize, R)> = thread::scope(|scope| {
+        let workers: Vec<_> = (0..workers)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut done = vec![];
+                    loop {
+                        let index = next.fetch_add(1, Ordering::Relaxed);
+                        if index >= items.len() {
+                            return done;
+                        }
+                        done.push((index, f(&items[index])));
+                    }
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .flat_map(|worker| worker.join().unwrap())
+            .collect()
+    });
+    results.sort_by_key(|(index, _)| *index);
+    results.into_iter().map(|(_, result)| result).collect()
+}
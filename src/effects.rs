@@ -0,0 +1,423 @@
+use std::collections::HashMap;
+
+use crate::{
+    ast::{Block, Expression, Statement, Type, Variable},
+    error::{Error, Result},
+    reachability,
+};
+
+// What calling a function can do, from best to worst. A pure call depends
+// only on its arguments, so repeated calls with the same arguments can be
+// merged, hoisted out of loops, or dropped if the result is unused. A
+// read-only call also reads memory, so it can only be merged or hoisted
+// when no write happens in between.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub(crate) enum Effect {
+    Pure,
+    ReadOnly,
+    Impure,
+}
+
+// Effects of std functions better than impure, by module path. Other
+// functions from imported modules are opaque until modules are compiled
+// together, and count as impure.
+const STD_FUNCTION_EFFECTS: &[(&str, &[(&str, Effect)])] = &[
+    (
+        "std/math",
+        &[
+            ("sqrt", Effect::Pure),
+            ("exp", Effect::Pure),
+            ("log", Effect::Pure),
+            ("sin", Effect::Pure),
+            ("cos", Effect::Pure),
+            ("pow", Effect::Pure),
+            ("sqrtf", Effect::Pure),
+            ("expf", Effect::Pure),
+            ("logf", Effect::Pure),
+            ("sinf", Effect::Pure),
+            ("cosf", Effect::Pure),
+            ("powf", Effect::Pure),
+            ("vsqrt", Effect::Pure),
+            ("vexp", Effect::Pure),
+            ("vlog", Effect::Pure),
+            ("vsin", Effect::Pure),
+            ("vcos", Effect::Pure),
+            ("vpow", Effect::Pure),
+        ],
+    ),
+    (
+        "std/math/fast",
+        &[
+            ("sqrtf", Effect::Pure),
+            ("expf", Effect::Pure),
+            ("logf", Effect::Pure),
+            ("sinf", Effect::Pure),
+            ("cosf", Effect::Pure),
+            ("powf", Effect::Pure),
+            ("vsqrt", Effect::Pure),
+            ("vexp", Effect::Pure),
+            ("vlog", Effect::Pure),
+            ("vsin", Effect::Pure),
+            ("vcos", Effect::Pure),
+            ("vpow", Effect::Pure),
+        ],
+    ),
+    (
+        "std/bits",
+        &[
+            ("popcount", Effect::Pure),
+            ("clz", Effect::Pure),
+            ("ctz", Effect::Pure),
+            ("rotl", Effect::Pure),
+            ("rotr", Effect::Pure),
+            ("bswap", Effect::Pure),
+            ("pdep", Effect::Pure),
+            ("pext", Effect::Pure),
+            ("pdep_portable", Effect::Pure),
+            ("pext_portable", Effect::Pure),
+        ],
+    ),
+    // wyhash reads the bytes it's given.
+    (
+        "std/hash",
+        &[("wymix", Effect::Pure), ("wyhash", Effect::ReadOnly)],
+    ),
+    // `assume` returns nothing, so as a pure call it would be deleted as
+    // dead code along with the fact it tells the optimizer. It's left out
+    // so it counts as having side effects.
+    (
+        "std/hint",
+        &[("likely", Effect::Pure), ("unlikely", Effect::Pure)],
+    ),
+];
+
+struct Function<'a> {
+    params: &'a [Variable],
+    body: &'a Block<Statement>,
+    is_async: bool,
+}
+
+// A top-level function: the index of its file and its name.
+type FunctionId = (usize, String);
+
+// Infers the effect of every top-level function in `files`, returning a
+// table per file. Starts by assuming each function is pure and raises it
+// to the worst effect of its own body and of everything it calls, in any
+// of the files, until nothing changes, so recursive functions stay pure
+// unless something in the cycle isn't. Rejects @pure functions that turn
+// out not to be.
+pub(crate) fn analyze(files: &[(String, Vec<Statement>)]) -> Result<Vec<HashMap<String, Effect>>> {
+    let inputs = reachability::modules(files);
+    let mut functions: HashMap<FunctionId, Function> = HashMap::new();
+    let mut std_modules: Vec<HashMap<String, String>> = vec![];
+    for (index, (_, statements)) in files.iter().enumerate() {
+        let mut modules = HashMap::new();
+        for statement in statements {
+            match statement {
+                Statement::Import(path, alias) => {
+                    let name = match alias {
+                        Some(alias) => alias.0.clone(),
+                        None => path.0.rsplit('/').next().unwrap().to_string(),
+                    };
+                    modules.insert(name, path.0.clone());
+                }
+                Statement::Function(name, params, _, body, is_async, _) => {
+                    functions.insert(
+                        (index, name.0.clone()),
+                        Function {
+                            params,
+                            body,
+                            is_async: *is_async,
+                        },
+                    );
+                }
+                _ => {}
+            }
+        }
+        std_modules.push(modules);
+    }
+
+    let mut local: HashMap<&FunctionId, (Effect, Vec<FunctionId>)> = HashMap::new();
+    for (id, function) in &functions {
+        let mut walker = Walker {
+            file: id.0,
+            params: function.params,
+            locals: vec![],
+            functions: &functions,
+            inputs: &inputs[id.0],
+            modules: &std_modules[id.0],
+            effect: Effect::Pure,
+            callees: vec![],
+        };
+        // Calling an async function only builds its frame, but nothing can
+        // be assumed about what polling the frame does later.
+        if function.is_async {
+            walker.effect = Effect::Impure;
+        }
+        walker.statements(&function.body.ts);
+        local.insert(id, (walker.effect, walker.callees));
+    }
+
+    let mut effects: HashMap<FunctionId, Effect> = local
+        .iter()
+        .map(|(id, (effect, _))| ((*id).clone(), *effect))
+        .collect();
+    let mut changed = true;
+    while changed {
+        changed = false;
+        for (id, (_, callees)) in &local {
+            let effect = callees
+                .iter()
+                .map(|callee| effects[callee])
+                .fold(effects[*id], Effect::max);
+            if effect != effects[*id] {
+                effects.insert((*id).clone(), effect);
+                changed = true;
+            }
+        }
+    }
+
+    // In input and source order, so the error reported is always the first
+    // one.
+    for (index, (_, statements)) in files.iter().enumerate() {
+        for statement in statements {
+            let Statement::Function(name, _, _, _, _, attributes) = statement else {
+                continue;
+            };
+            let Some(pure) = attributes.iter().find(|a| a.name.0 == "pure") else {
+                continue;
+            };
+            let message = match effects[&(index, name.0.clone())] {
+                Effect::Pure => continue,
+                Effect::ReadOnly => "Function marked @pure reads memory",
+                Effect::Impure => "Function marked @pure has side effects",
+            };
+            return Err(Error::new(message, pure.name.1.clone()));
+        }
+    }
+
+    let mut tables = vec![HashMap::new(); files.len()];
+    for ((index, name), effect) in effects {
+        tables[index].insert(name, effect);
+    }
+    Ok(tables)
+}
+
+// Collects one function body's own effect and the functions it calls.
+struct Walker<'a> {
+    file: usize,
+    params: &'a [Variable],
+    locals: Vec<String>,
+    functions: &'a HashMap<FunctionId, Function<'a>>,
+    // Imports of other input files, and the paths of all imports, by the
+    // local name they're imported as.
+    inputs: &'a HashMap<String, usize>,
+    modules: &'a HashMap<String, String>,
+    effect: Effect,
+    callees: Vec<FunctionId>,
+}
+
+impl Walker<'_> {
+    fn statements(&mut self, statements: &[Statement]) {
+        for statement in statements {
+            match statement {
+                Statement::For(name, iterable, body, _) => {
+                    self.expression(iterable);
+                    self.locals.push(name.0.clone());
+                    self.statements(&body.ts);
+                    self.locals.pop();
+                }
+                Statement::Expression(expr) => self.expression(expr),
+                // Nested functions only have an effect when called.
+                _ => {}
+            }
+        }
+    }
+
+    fn expression(&mut self, expr: &Expression) {
+        match expr {
+            Expression::Identifier((name, _)) => self.read(name),
+            Expression::Integer(_) | Expression::String(_) => {}
+            Expression::Range(start, end) => {
+                self.expression(&start.0);
+                self.expression(&end.0);
+            }
+            Expression::Call(callee, args) => {
+                match &*callee.0 {
+                    Expression::Identifier((name, _)) if self.is_function(self.file, name) => {
+                        self.callees.push((self.file, name.clone()))
+                    }
+                    // Unknown functions and function pointers.
+                    _ => self.effect = Effect::Impure,
+                }
+                for (arg, _) in args {
+                    self.expression(arg);
+                }
+            }
+            Expression::Access(base, member) => {
+                if let (Expression::Identifier((module, _)), Expression::Call(callee, args)) =
+                    (&*base.0, &*member.0)
+                {
+                    let input = self.inputs.get(module).copied();
+                    match (input, &*callee.0) {
+                        (Some(file), Expression::Identifier((name, _)))
+                            if self.is_function(file, name) =>
+                        {
+                            self.callees.push((file, name.clone()));
+                            for (arg, _) in args {
+                                self.expression(arg);
+                            }
+                            return;
+                        }
+                        _ => {}
+                    }
+                    if let Some(path) = self.modules.get(module) {
+                        self.effect = self.effect.max(std_function_effect(path, &callee.0));
+                        for (arg, _) in args {
+                            self.expression(arg);
+                        }
+                        return;
+                    }
+                }
+                self.expression(&base.0);
+                match &*member.0 {
+                    // A field read; the base already accounted for the memory.
+                    Expression::Identifier(_) => {}
+                    // Method calls aren't resolved yet.
+                    _ => self.effect = Effect::Impure,
+                }
+            }
+            Expression::Await(_) | Expression::MutableReference(_) => self.effect = Effect::Impure,
+            Expression::Reference(expr) => self.expression(&expr.0),
+        }
+    }
+
+    fn is_function(&self, file: usize, name: &str) -> bool {
+        self.functions.contains_key(&(file, name.to_string()))
+    }
+
+    // Naming a local or a by-value parameter is free. Anything else is a
+    // global or goes through a pointer, which reads memory.
+    fn read(&mut self, name: &str) {
+        if self.locals.iter().any(|local| local == name) {
+            return;
+        }
+        let by_value = self.params.iter().any(|param| {
+            param.name.0 == name
+                && !matches!(
+                    param.ty.0,
+                    Type::Reference(_)
+                        | Type::MutableReference(_)
+                        | Type::Pointer(_)
+                        | Type::MutablePointer(_)
+                        | Type::Slice(_)
+                        | Type::MutableSlice(_)
+                )
+        });
+        if !by_value && !self.is_function(self.file, name) {
+            self.effect = self.effect.max(Effect::ReadOnly);
+        }
+    }
+}
+
+fn std_function_effect(path: &str, callee: &Expression) -> Effect {
+    let Expression::Identifier((name, _)) = callee else {
+        return Effect::Impure;
+    };
+    STD_FUNCTION_EFFECTS
+        .iter()
+        .filter(|(module, _)| *module == path)
+        .flat_map(|(_, functions)| functions.iter())
+        .find(|(function, _)| function == name)
+        .map_or(Effect::Impure, |(_, effect)| *effect)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::{collections::HashMap, fs};
+
+    use super::{analyze, Effect, STD_FUNCTION_EFFECTS};
+    use crate::{ast::Statement, error::Result, parser::tests::parse_files};
+
+    fn effects(sources: &[(&str, &str)]) -> Result<Vec<HashMap<String, Effect>>> {
+        analyze(&parse_files(sources))
+    }
+
+    #[test]
+    fn std_functions_exist() {
+        for (module, functions) in STD_FUNCTION_EFFECTS {
+            let path = format!("{}/{}.vc", env!("CARGO_MANIFEST_DIR"), module);
+            let source = fs::read_to_string(&path).unwrap();
+            for (function, _) in *functions {
+                let declared = source.lines().any(|line| {
+                    let line = line.strip_prefix("extern ").unwrap_or(line);
+                    line.strip_prefix("fn ").is_some_and(|rest| {
+                        rest.strip_prefix(function)
+                            .is_some_and(|rest| rest.starts_with(['(', '[']))
+                    })
+                });
+                assert!(declared, "{} doesn't define {}", module, function);
+            }
+        }
+    }
+
+    #[test]
+    fn first_pure_violation_is_reported() {
+        let mut source = String::new();
+        for index in 0..20 {
+            source.push_str(&format!("@pure\nfn f{}():\n    io.println(1)\n\n", index));
+        }
+        let files = parse_files(&[("a.velocity", &source), ("b.velocity", &source)]);
+        let Err(error) = analyze(&files) else {
+            panic!("expecting an error");
+        };
+        let Statement::Function(_, _, _, _, _, attributes) = &files[0].1[0] else {
+            panic!("expecting a function");
+        };
+        assert_eq!(error.span(), &attributes[0].name.1);
+    }
+
+    #[test]
+    fn assume_is_not_dead_code() {
+        let source = "import std/hint as hint\n\nfn f(n: uint):\n    hint.assume(n)\n";
+        let Ok(effects) = effects(&[("a.velocity", source)]) else {
+            panic!("analysis failed");
+        };
+        assert_eq!(effects[0]["f"], Effect::Impure);
+    }
+
+    #[test]
+    fn calls_into_other_files() {
+        let Ok(effects) = effects(&[
+            (
+                "main.velocity",
+                "import geometry as g\n\nfn f(n: uint):\n    g.area(n)\n\nfn h(n: uint):\n    g.show(n)\n\nfn k(n: uint):\n    g.missing(n)\n",
+            ),
+            (
+                "geometry.velocity",
+                "fn area(n: uint):\n    n\n\nfn show(n: uint):\n    io.println(n)\n",
+            ),
+        ]) else {
+            panic!("analysis failed");
+        };
+        assert_eq!(effects[0]["f"], Effect::Pure);
+        assert_eq!(effects[0]["h"], Effect::Impure);
+        assert_eq!(effects[0]["k"], Effect::Impure);
+        assert_eq!(effects[1]["area"], Effect::Pure);
+    }
+
+    #[test]
+    fn pure_across_files() {
+        let result = effects(&[
+            (
+                "main.velocity",
+                "import geometry\n\n@pure\nfn f(n: uint):\n    geometry.show(n)\n",
+            ),
+            (
+                "geometry.velocity",
+                "fn show(n: uint):\n    io.println(n)\n",
+            ),
+        ]);
+        assert!(result.is_err());
+    }
+}
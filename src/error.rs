@@ -17,6 +17,11 @@ impl Error {
             span,
         }
     }
+
+    #[cfg(test)]
+    pub(crate) fn span(&self) -> &Span {
+        &self.span
+    }
 }
 
 impl Display for Error {
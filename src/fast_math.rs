@@ -0,0 +1,123 @@
+use crate::{
+    ast::Attribute,
+    error::{Error, Result},
+};
+
+// Floating-point rules a function may relax, matching LLVM's fast-math
+// flags of the same names. Reassociation is what lets a reduction like
+// `sum += x * x` be split across vector lanes; contraction lets `a * b + c`
+// become one fused multiply-add.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Hash)]
+pub(crate) struct FastMath {
+    pub(crate) reassoc: bool,
+    pub(crate) contract: bool,
+    pub(crate) nnan: bool,
+    pub(crate) ninf: bool,
+}
+
+impl FastMath {
+    pub(crate) fn all() -> FastMath {
+        FastMath {
+            reassoc: true,
+            contract: true,
+            nnan: true,
+            ninf: true,
+        }
+    }
+
+    // The flags for a function: @fast_math enables everything, or just the
+    // flags it names as in @fast_math(reassoc, contract); @strict_math
+    // keeps IEEE semantics even when `--fast-math` is on for the whole
+    // program (`global`). A function can have only one of the two.
+    pub(crate) fn for_function(attributes: &[Attribute], global: FastMath) -> Result<FastMath> {
+        let mut flags = global;
+        let mut seen = false;
+        for attribute in attributes {
+            let name = attribute.name.0.as_str();
+            if name == "fast_math" || name == "strict_math" {
+                if seen {
+                    return Err(Error::new(
+                        "Conflicting floating-point attributes",
+                        attribute.name.1.clone(),
+                    ));
+                }
+                seen = true;
+            }
+            match name {
+                "strict_math" => flags = FastMath::default(),
+                "fast_math" if attribute.args.is_empty() => flags = FastMath::all(),
+                "fast_math" => {
+                    flags = FastMath::default();
+                    for (arg, span) in &attribute.args {
+                        match arg.as_str() {
+                            "reassoc" => flags.reassoc = true,
+                            "contract" => flags.contract = true,
+                            "nnan" => flags.nnan = true,
+                            "ninf" => flags.ninf = true,
+                            _ => {
+                                return Err(Error::new(
+                                    "Expecting reassoc, contract, nnan or ninf",
+                                    span.clone(),
+                                ))
+                            }
+                        }
+                    }
+                }
+                _ => {}
+            }
+        }
+        Ok(flags)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::FastMath;
+    use crate::{ast::Statement, error::Result, parser::tests::parse};
+
+    // The flags `attributes` give a function under `global`.
+    fn flags(attributes: &str, global: FastMath) -> Result<FastMath> {
+        let source = format!("{}\nfn f():\n    f\n", attributes);
+        let Ok(statements) = parse(&source) else {
+            panic!("parse failed");
+        };
+        let Statement::Function(.., attributes) = &statements[0] else {
+            panic!("expecting a function");
+        };
+        FastMath::for_function(attributes, global)
+    }
+
+    #[test]
+    fn function_flags() {
+        let strict = FastMath::default();
+        assert!(matches!(flags("", strict), Ok(f) if f == strict));
+        assert!(matches!(flags("", FastMath::all()), Ok(f) if f == FastMath::all()));
+        assert!(matches!(flags("@fast_math", strict), Ok(f) if f == FastMath::all()));
+        assert!(matches!(flags("@strict_math", FastMath::all()), Ok(f) if f == strict));
+        let some = FastMath {
+            reassoc: true,
+            contract: true,
+            ..strict
+        };
+        assert!(matches!(flags("@fast_math(reassoc, contract)", strict), Ok(f) if f == some));
+        assert!(matches!(
+            flags("@fast_math(reassoc, contract)", FastMath::all()),
+            Ok(f) if f == some
+        ));
+    }
+
+    #[test]
+    fn invalid_function_flags() {
+        for attributes in [
+            "@fast_math(fast)",
+            "@fast_math @strict_math",
+            "@strict_math\n@fast_math(nnan)",
+        ] {
+            assert!(
+                flags(attributes, FastMath::default()).is_err(),
+                "{}",
+                attributes
+            );
+        }
+    }
+}
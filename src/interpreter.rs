@@ -0,0 +1,346 @@
+use std::{
+    collections::HashMap,
+    io::Write,
+    sync::{
+        mpsc::{self, Receiver, Sender},
+        Arc,
+    },
+    thread,
+};
+
+use crate::{
+    ast::Statement,
+    bytecode::{self, Function, FunctionId, Instruction, Value},
+    error::{Error, Result},
+    reachability,
+};
+
+// Calls plus loop back-edges after which a function is optimized.
+const HOT_THRESHOLD: u32 = 1000;
+
+// An entry in the function table. Calls are compiled against table
+// indices, so a function only has to be lowered once something actually
+// calls it; the first call replaces its stub.
+enum Slot {
+    Stub(usize, String),
+    Ready(Tiers),
+}
+
+// A function starts out as the bytecode it's first lowered to. Once it's
+// hot, an optimized version is built on a background thread, so execution
+// never waits for it, and calls from then on use that instead. A loop
+// already running keeps running the old code until its function returns.
+struct Tiers {
+    baseline: Arc<Function>,
+    optimized: Option<Arc<Function>>,
+    hotness: u32,
+}
+
+// The background thread's queues: functions to optimize, and the results.
+struct Optimizer {
+    requests: Sender<(FunctionId, Arc<Function>)>,
+    results: Receiver<(FunctionId, Arc<Function>)>,
+}
+
+pub(crate) struct Interpreter<'a> {
+    files: &'a [(String, Vec<Statement>)],
+    modules: Vec<HashMap<String, usize>>,
+    slots: Vec<Slot>,
+    ids: HashMap<(usize, String), FunctionId>,
+    optimizer: Option<Optimizer>,
+    // Where print and println write.
+    out: &'a mut dyn Write,
+}
+
+impl<'a> Interpreter<'a> {
+    pub(crate) fn new(
+        files: &'a [(String, Vec<Statement>)],
+        out: &'a mut dyn Write,
+    ) -> Interpreter<'a> {
+        Interpreter {
+            files,
+            modules: reachability::modules(files),
+            slots: vec![],
+            ids: HashMap::new(),
+            optimizer: None,
+            out,
+        }
+    }
+
+    // Runs `main` from the first file that defines one, returning false if
+    // none does. Only `main` is lowered up front, so startup time doesn't
+    // grow with the parts of the program that never run.
+    pub(crate) fn run(&mut self) -> Result<bool> {
+        let Some(file) = self
+            .files
+            .iter()
+            .position(|(_, statements)| bytecode::find_function(statements, "main").is_some())
+        else {
+            return Ok(false);
+        };
+        let main = self.resolve(file, "main");
+        self.function(main)?;
+        self.call(main, vec![])?;
+        Ok(true)
+    }
+
+    // Runs `main` as `tier` rewrites its baseline bytecode, and returns its
+    // registers at the end, so tiers can be compared.
+    #[cfg(test)]
+    pub(crate) fn run_main_with(
+        &mut self,
+        tier: impl Fn(&Function) -> Function,
+    ) -> Result<(Function, Vec<Value>)> {
+        let file = self
+            .files
+            .iter()
+            .position(|(_, statements)| bytecode::find_function(statements, "main").is_some())
+            .unwrap();
+        let main = self.resolve(file, "main");
+        let baseline = self.function(main)?;
+        let function = tier(&baseline);
+        let mut registers = vec![Value::Unit; function.registers];
+        self.execute(main, &function, &mut registers)?;
+        Ok((function, registers))
+    }
+
+    fn resolve(&mut self, file: usize, name: &str) -> FunctionId {
+        resolve(&mut self.slots, &mut self.ids, file, name)
+    }
+
+    // The best bytecode for `id` so far, lowering it first if it's still a
+    // stub.
+    fn function(&mut self, id: FunctionId) -> Result<Arc<Function>> {
+        let (file, name) = match &self.slots[id] {
+            Slot::Ready(tiers) => {
+                return Ok(tiers.optimized.as_ref().unwrap_or(&tiers.baseline).clone())
+            }
+            Slot::Stub(file, name) => (*file, name.clone()),
+        };
+        let statement = bytecode::find_function(&self.files[file].1, &name).unwrap();
+        let (slots, ids) = (&mut self.slots, &mut self.ids);
+        let function = Arc::new(bytecode::lower(
+            self.files,
+            &self.modules,
+            file,
+            statement,
+            &mut |file, name| resolve(slots, ids, file, name),
+        )?);
+        self.slots[id] = Slot::Ready(Tiers {
+            baseline: function.clone(),
+            optimized: None,
+            hotness: 0,
+        });
+        Ok(function)
+    }
+
+    // Counts a call or a back-edge, and hands the function to the
+    // optimizer the moment it becomes hot.
+    fn heat(&mut self, id: FunctionId) {
+        let Slot::Ready(tiers) = &mut self.slots[id] else {
+            unreachable!()
+        };
+        tiers.hotness = tiers.hotness.saturating_add(1);
+        if tiers.hotness != HOT_THRESHOLD {
+            return;
+        }
+        let baseline = tiers.baseline.clone();
+        let optimizer = self.optimizer.get_or_insert_with(|| {
+            let (requests, queue) = mpsc::channel::<(FunctionId, Arc<Function>)>();
+            let (done, results) = mpsc::channel();
+            thread::spawn(move || {
+                for (id, function) in queue {
+                    if done
+                        .send((id, Arc::new(bytecode::optimize(&function))))
+                        .is_err()
+                    {
+                        return;
+                    }
+                }
+            });
+            Optimizer { requests, results }
+        });
+        let _ = optimizer.requests.send((id, baseline));
+    }
+
+    // Switches to whatever the optimizer has finished.
+    fn install_optimized(&mut self) {
+        let Some(optimizer) = &self.optimizer else {
+            return;
+        };
+        while let Ok((id, function)) = optimizer.results.try_recv() {
+            if let Slot::Ready(tiers) = &mut self.slots[id] {
+                tiers.optimized = Some(function);
+            }
+        }
+    }
+
+    fn call(&mut self, id: FunctionId, args: Vec<Value>) -> Result<Value> {
+        self.install_optimized();
+        let function = self.function(id)?;
+        self.heat(id);
+        let mut registers = args;
+        registers.resize(function.registers, Value::Unit);
+        self.execute(id, &function, &mut registers)
+    }
+
+    // Runs `function`, the bytecode of table entry `id` in some tier, on
+    // `registers`.
+    fn execute(
+        &mut self,
+        id: FunctionId,
+        function: &Function,
+        registers: &mut [Value],
+    ) -> Result<Value> {
+        let mut pc = 0;
+        loop {
+            match &function.code[pc] {
+                Instruction::LoadUnit(destination) => {
+                    registers[*destination as usize] = Value::Unit
+                }
+                Instruction::LoadInt(destination, value) => {
+                    registers[*destination as usize] = Value::Int(*value)
+                }
+                Instruction::LoadString(destination, index) => {
+                    registers[*destination as usize] =
+                        Value::Str(function.strings[*index as usize].clone())
+                }
+                Instruction::Move(destination, source) => {
+                    registers[*destination as usize] = registers[*source as usize].clone()
+                }
+                Instruction::Call(callee, base, count) => {
+                    let base = *base as usize;
+                    let args = registers[base..base + *count as usize].to_vec();
+                    registers[base] = self.call(*callee, args)?;
+                }
+                Instruction::Print(base, count, newline) => {
+                    let base = *base as usize;
+                    let Value::Str(format) = &registers[base] else {
+                        unreachable!()
+                    };
+                    let mut out = String::new();
+                    let mut pieces = format.split("{}");
+                    out.push_str(pieces.next().unwrap());
+                    for (arg, piece) in registers[base + 1..base + 1 + *count as usize]
+                        .iter()
+                        .zip(pieces)
+                    {
+                        out.push_str(&arg.to_string());
+                        out.push_str(piece);
+                    }
+                    if *newline {
+                        out.push('\n');
+                    }
+                    // Output may be piped into something that exits early.
+                    let _ = self.out.write_all(out.as_bytes());
+                }
+                Instruction::JumpIfNotLess(a, b, target) => {
+                    let (Value::Int(a), Value::Int(b)) =
+                        (&registers[*a as usize], &registers[*b as usize])
+                    else {
+                        return Err(Error::new(
+                            "Expecting integer range bounds",
+                            function.spans[pc].clone(),
+                        ));
+                    };
+                    if a >= b {
+                        pc = *target as usize;
+                        continue;
+                    }
+                }
+                Instruction::Increment(register) => {
+                    if let Value::Int(value) = &mut registers[*register as usize] {
+                        *value += 1;
+                    }
+                }
+                Instruction::Loop(target) => {
+                    self.heat(id);
+                    pc = *target as usize;
+                    continue;
+                }
+                // Only reached after the loop's JumpIfNotLess, so both are
+                // integers.
+                Instruction::ForLoop(index, limit, target) => {
+                    let Value::Int(limit) = registers[*limit as usize] else {
+                        unreachable!()
+                    };
+                    let Value::Int(index) = &mut registers[*index as usize] else {
+                        unreachable!()
+                    };
+                    *index += 1;
+                    if *index < limit {
+                        self.heat(id);
+                        pc = *target as usize;
+                        continue;
+                    }
+                }
+                Instruction::Return => return Ok(Value::Unit),
+            }
+            pc += 1;
+        }
+    }
+}
+
+// A free function so lowering can allocate table entries while the
+// interpreter is borrowed.
+fn resolve(
+    slots: &mut Vec<Slot>,
+    ids: &mut HashMap<(usize, String), FunctionId>,
+    file: usize,
+    name: &str,
+) -> FunctionId {
+    *ids.entry((file, name.to_string())).or_insert_with(|| {
+        slots.push(Slot::Stub(file, name.to_string()));
+        slots.len() - 1
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Interpreter;
+    use crate::parser::tests::parse;
+
+    // Runs `main` and returns what it printed.
+    fn run(source: &str) -> String {
+        let Ok(statements) = parse(source) else {
+            panic!("parse failed");
+        };
+        let files = vec![("test.velocity".to_string(), statements)];
+        let mut out = vec![];
+        let result = Interpreter::new(&files, &mut out).run();
+        assert!(matches!(result, Ok(true)));
+        String::from_utf8(out).unwrap()
+    }
+
+    #[test]
+    fn call_without_arguments() {
+        assert_eq!(
+            run("fn hello():\n    println(\"hello\")\n\nfn main():\n    hello()\n"),
+            "hello\n"
+        );
+    }
+
+    #[test]
+    fn call_without_arguments_as_argument() {
+        assert_eq!(
+            run("fn unit():\n    print(\"\")\n\nfn main():\n    print(\"{}\", unit())\n"),
+            "()"
+        );
+    }
+
+    #[test]
+    fn calls_with_arguments() {
+        assert_eq!(
+            run(concat!(
+                "fn show(a: int, b: string):\n",
+                "    println(\"{} {}\", a, b)\n",
+                "\n",
+                "fn main():\n",
+                "    show(1, \"one\")\n",
+                "    for i in 0..3:\n",
+                "        show(i, \"loop\")\n",
+            )),
+            "1 one\n0 loop\n1 loop\n2 loop\n"
+        );
+    }
+}
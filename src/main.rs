@@ -1,25 +1,70 @@
+use cache::Cache;
 use compiler::Compiler;
 
 mod ast;
+mod borrow;
+mod bytecode;
+mod cache;
 mod compiler;
+mod effects;
 mod error;
+mod fast_math;
+mod interpreter;
 mod parser;
+mod partition;
+mod reachability;
 mod span;
 mod tokenizer;
 
 fn main() {
     let args: Vec<String> = std::env::args().skip(1).collect::<Vec<String>>();
     if args.len() == 0 {
-        println!("Usage: velocity <filename>");
+        println!(
+            "Usage: velocity [run] [--fast-math] [--cache-dir <dir>] [--codegen-units <n>] <filename>..."
+        );
         return;
     }
 
     let mut compiler = Compiler::new();
-    for filename in args {
-        compiler.add_file(filename);
+    let mut args = args.into_iter().peekable();
+    let run = args.next_if(|arg| arg == "run").is_some();
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--fast-math" => compiler.enable_fast_math(),
+            "--codegen-units" => match args.next().map(|n| n.parse::<usize>()) {
+                Some(Ok(units)) if units > 0 => compiler.set_codegen_units(units),
+                _ => {
+                    eprintln!("option '--codegen-units' requires a positive number");
+                    return;
+                }
+            },
+            "--cache-dir" => {
+                let Some(dir) = args.next() else {
+                    eprintln!("option '--cache-dir' requires a directory");
+                    return;
+                };
+                match Cache::open(&dir) {
+                    Ok(cache) => compiler.use_cache(cache),
+                    Err(err) => {
+                        eprintln!("failed to open cache directory '{}': {}", dir, err);
+                        return;
+                    }
+                }
+            }
+            _ if arg.starts_with("--") => {
+                eprintln!("unknown option '{}'", arg);
+                return;
+            }
+            _ => compiler.add_file(arg),
+        }
     }
 
-    match compiler.compile() {
+    let result = if run {
+        compiler.run()
+    } else {
+        compiler.compile()
+    };
+    match result {
         Ok(_) => {}
         Err(err) => {
             eprintln!("{}", err);
@@ -1,19 +1,32 @@
 use crate::{
-    ast::{Block, Expression, Statement, Type, Variable},
+    ast::{
+        ArrayLength, Attribute, Block, Expression, LoopHints, Statement, Type, Unroll, Variable,
+        Vectorize,
+    },
     error::{Error, Result},
     span::spanned,
     tokenizer::{Token, TokenKind},
 };
 
+const FUNCTION_ATTRIBUTES: &[&str] = &["cold", "export", "fast_math", "pure", "strict_math"];
+const LOOP_ATTRIBUTES: &[&str] = &["no_vectorize", "unroll", "vectorize"];
+// Attributes that are flags and take no arguments.
+const FLAG_ATTRIBUTES: &[&str] = &["cold", "export", "no_vectorize", "pure", "strict_math"];
+
 #[derive(Debug, Clone)]
 pub(crate) struct Parser {
     tokens: Vec<Token>,
     current: usize,
+    in_async: bool,
 }
 
 impl Parser {
     pub(crate) fn new(tokens: Vec<Token>) -> Self {
-        Self { tokens, current: 0 }
+        Self {
+            tokens,
+            current: 0,
+            in_async: false,
+        }
     }
 
     pub(crate) fn parse(&mut self) -> Result<Vec<Statement>> {
@@ -32,7 +45,19 @@ impl Parser {
         match self.current().kind {
             TokenKind::Import => self.import(),
             TokenKind::Struct => self.struct_(),
-            TokenKind::Fn => self.function(),
+            TokenKind::Fn | TokenKind::Async => self.function(vec![]),
+            TokenKind::For => self.for_(vec![]),
+            TokenKind::At => {
+                let attributes = self.attributes()?;
+                match self.current().kind {
+                    TokenKind::Fn | TokenKind::Async => self.function(attributes),
+                    TokenKind::For => self.for_(attributes),
+                    _ => Err(self.error(
+                        self.current(),
+                        "Expecting function or for loop after attributes",
+                    )),
+                }
+            }
             _ => {
                 let expr = self.expression()?;
                 Ok(Statement::Expression(expr))
@@ -84,7 +109,16 @@ impl Parser {
         })
     }
 
-    fn function(&mut self) -> Result<Statement> {
+    fn function(&mut self, attributes: Vec<Attribute>) -> Result<Statement> {
+        self.check_attributes(
+            &attributes,
+            FUNCTION_ATTRIBUTES,
+            "Unknown function attribute",
+        )?;
+        let is_async = self.check(TokenKind::Async);
+        if is_async {
+            self.consume(TokenKind::Async)?;
+        }
         self.consume(TokenKind::Fn)?;
         let name = self.consume(TokenKind::Identifier)?.clone();
         self.consume(TokenKind::LeftParenthesis)?;
@@ -112,15 +146,159 @@ impl Parser {
         } else {
             (Type::Unit, self.current().span.clone())
         };
-        let block = self.block(|parser| parser.statement())?;
+        // Nested functions don't inherit the enclosing function's asyncness.
+        let enclosing = std::mem::replace(&mut self.in_async, is_async);
+        let block = self.block(|parser| parser.statement());
+        self.in_async = enclosing;
         Ok(Statement::Function(
             spanned(name.lexeme.to_string().clone(), name.span.clone()),
             params,
             spanned(ty, ty_span),
+            block?,
+            is_async,
+            attributes,
+        ))
+    }
+
+    fn for_(&mut self, attributes: Vec<Attribute>) -> Result<Statement> {
+        self.check_attributes(&attributes, LOOP_ATTRIBUTES, "Unknown loop attribute")?;
+        let hints = self.loop_hints(&attributes)?;
+        self.consume(TokenKind::For)?;
+        let name = self.consume(TokenKind::Identifier)?;
+        self.consume(TokenKind::In)?;
+        let start = self.expression()?;
+        let iterable = if self.check(TokenKind::DotDot) {
+            self.consume(TokenKind::DotDot)?;
+            let end = self.expression()?;
+            Expression::Range(
+                spanned(Box::new(start.clone()), start.span()),
+                spanned(Box::new(end.clone()), end.span()),
+            )
+        } else {
+            start
+        };
+        let block = self.block(|parser| parser.statement())?;
+        Ok(Statement::For(
+            spanned(name.lexeme.to_string().clone(), name.span.clone()),
+            iterable,
             block,
+            hints,
         ))
     }
 
+    fn loop_hints(&self, attributes: &[Attribute]) -> Result<LoopHints> {
+        let mut hints = LoopHints::default();
+        for attribute in attributes {
+            let (name, span) = &attribute.name;
+            if attribute.args.len() > 1 {
+                return Err(Error::new("Too many attribute arguments", span.clone()));
+            }
+            let count = match attribute.args.first() {
+                Some((arg, span)) => match arg.parse::<usize>() {
+                    Ok(count) => Some((count, span)),
+                    Err(_) => return Err(Error::new("Expecting integer", span.clone())),
+                },
+                None => None,
+            };
+            match name.as_str() {
+                "unroll" => {
+                    hints.unroll = Some(match count {
+                        None => Unroll::Full,
+                        Some((count, _)) if count >= 1 => Unroll::Times(count),
+                        Some((_, span)) => {
+                            return Err(Error::new(
+                                "Expecting unroll factor of at least 1",
+                                span.clone(),
+                            ))
+                        }
+                    })
+                }
+                _ if hints.vectorize.is_some() => {
+                    return Err(Error::new(
+                        "Conflicting vectorization attributes",
+                        span.clone(),
+                    ))
+                }
+                "vectorize" => {
+                    hints.vectorize = Some(Vectorize::Width(match count {
+                        None => None,
+                        Some((width, _))
+                            if width >= 2 && width <= 64 && width.is_power_of_two() =>
+                        {
+                            Some(width)
+                        }
+                        Some((_, span)) => {
+                            return Err(Error::new(
+                                "Expecting vector width to be a power of two between 2 and 64",
+                                span.clone(),
+                            ))
+                        }
+                    }))
+                }
+                _ => hints.vectorize = Some(Vectorize::Never),
+            }
+        }
+        Ok(hints)
+    }
+
+    // One or more @name or @name(arg, ...), each optionally on its own line.
+    fn attributes(&mut self) -> Result<Vec<Attribute>> {
+        let mut attributes = vec![];
+        while self.check(TokenKind::At) {
+            self.consume(TokenKind::At)?;
+            let name = self.consume(TokenKind::Identifier)?;
+            let mut args = vec![];
+            if self.check(TokenKind::LeftParenthesis) {
+                self.consume(TokenKind::LeftParenthesis)?;
+                while !self.check(TokenKind::RightParenthesis) {
+                    let arg = if self.check(TokenKind::Integer) {
+                        self.consume(TokenKind::Integer)?
+                    } else {
+                        self.consume(TokenKind::Identifier)?
+                    };
+                    args.push(spanned(arg.lexeme.to_string().clone(), arg.span.clone()));
+                    if self.check(TokenKind::Comma) {
+                        self.consume(TokenKind::Comma)?;
+                    }
+                }
+                self.consume(TokenKind::RightParenthesis)?;
+            }
+            attributes.push(Attribute {
+                name: spanned(name.lexeme.to_string().clone(), name.span.clone()),
+                args,
+            });
+            if self.check(TokenKind::Linefeed) {
+                self.advance();
+            }
+        }
+        Ok(attributes)
+    }
+
+    fn check_attributes(
+        &self,
+        attributes: &[Attribute],
+        allowed: &[&str],
+        message: &str,
+    ) -> Result<()> {
+        for (index, attribute) in attributes.iter().enumerate() {
+            if !allowed.contains(&attribute.name.0.as_str()) {
+                return Err(Error::new(message, attribute.name.1.clone()));
+            }
+            if attributes[..index]
+                .iter()
+                .any(|earlier| earlier.name.0 == attribute.name.0)
+            {
+                return Err(Error::new("Duplicate attribute", attribute.name.1.clone()));
+            }
+            if let Some((_, span)) = attribute.args.first() {
+                if FLAG_ATTRIBUTES.contains(&attribute.name.0.as_str()) {
+                    return Err(Error::new("Expecting no attribute arguments", span.clone()));
+                }
+            }
+        }
+        Ok(())
+    }
+
     fn expression(&mut self) -> Result<Expression> {
         let expr = self.primary()?;
         if self.check(TokenKind::LeftParenthesis) {
@@ -155,11 +333,47 @@ impl Parser {
                 token.lexeme.to_string().clone(),
                 token.span.clone(),
             ))),
+            TokenKind::Integer => Ok(Expression::Integer(spanned(
+                token.lexeme.to_string().clone(),
+                token.span.clone(),
+            ))),
+            TokenKind::String => Ok(Expression::String(spanned(
+                token.lexeme.to_string().clone(),
+                token.span.clone(),
+            ))),
             TokenKind::LeftParenthesis => {
                 let expr = self.expression()?;
                 self.consume(TokenKind::RightParenthesis)?;
                 Ok(expr)
             }
+            TokenKind::BitwiseAnd => {
+                if self.check(TokenKind::Mut) {
+                    self.consume(TokenKind::Mut)?;
+                    let expr = self.expression()?;
+                    Ok(Expression::MutableReference(spanned(
+                        Box::new(expr),
+                        token.span.clone(),
+                    )))
+                } else {
+                    let expr = self.expression()?;
+                    Ok(Expression::Reference(spanned(
+                        Box::new(expr),
+                        token.span.clone(),
+                    )))
+                }
+            }
+            // Each await is a suspension point of the enclosing function's
+            // state machine, so it can't appear outside an async function.
+            TokenKind::Await if !self.in_async => {
+                Err(self.error(&token, "Expecting await inside an async function"))
+            }
+            TokenKind::Await => {
+                let expr = self.expression()?;
+                Ok(Expression::Await(spanned(
+                    Box::new(expr),
+                    token.span.clone(),
+                )))
+            }
             _ => Err(self.error(&token, "Expecting expression")),
         }
     }
@@ -176,11 +390,15 @@ impl Parser {
             }
             TokenKind::Identifier => {
                 let id = self.consume(TokenKind::Identifier)?.clone();
-                if self.check(TokenKind::LeftBracket) {
+                // `vec` is only a type name here, not a keyword, so it stays
+                // usable as an ordinary identifier everywhere else.
+                if id.lexeme.as_str() == "vec" && self.check(TokenKind::LeftBracket) {
+                    self.vector_type()?
+                } else if self.check(TokenKind::LeftBracket) {
                     self.consume(TokenKind::LeftBracket)?;
                     let mut tys = vec![];
                     while !self.check(TokenKind::RightBracket) {
-                        tys.push(self.type_()?);
+                        tys.push(self.type_argument()?);
                         if self.check(TokenKind::Comma) {
                             self.consume(TokenKind::Comma)?;
                         }
@@ -207,11 +425,123 @@ impl Parser {
                     Type::Reference(Box::new(ty))
                 }
             }
-            _ => unreachable!(),
+            TokenKind::LeftBracket => {
+                self.consume(TokenKind::LeftBracket)?;
+                if !self.check(TokenKind::RightBracket) {
+                    return self.array_type();
+                }
+                // []T and []mut T: a pointer and a length borrowed from an
+                // array, a mapping or a fixed array. Indexing is checked
+                // against the length, and the elements are contiguous, so
+                // loops over a slice vectorize like loops over the array it
+                // came from.
+                self.consume(TokenKind::RightBracket)?;
+                if self.check(TokenKind::Mut) {
+                    self.consume(TokenKind::Mut)?;
+                    let ty = self.type_()?;
+                    Type::MutableSlice(Box::new(ty))
+                } else {
+                    let ty = self.type_()?;
+                    Type::Slice(Box::new(ty))
+                }
+            }
+            TokenKind::Asterisk => {
+                self.consume(TokenKind::Asterisk)?;
+                if self.check(TokenKind::Mut) {
+                    self.consume(TokenKind::Mut)?;
+                    let ty = self.type_()?;
+                    Type::MutablePointer(Box::new(ty))
+                } else {
+                    let ty = self.type_()?;
+                    Type::Pointer(Box::new(ty))
+                }
+            }
+            _ => {
+                let token = self.current().clone();
+                return Err(self.error(&token, "Expecting type"));
+            }
         };
         Ok(ty)
     }
 
+    // [T; N] after the opening bracket: N values of T stored inline, in a
+    // struct or on the stack. N is an integer literal or a constant, such as
+    // a const generic parameter, so the size is always known at compile
+    // time and loops over the elements can be fully unrolled.
+    fn array_type(&mut self) -> Result<Type> {
+        let ty = self.type_()?;
+        self.consume(TokenKind::Semicolon)?;
+        let length = if self.check(TokenKind::Identifier) {
+            let id = self.consume(TokenKind::Identifier)?;
+            ArrayLength::Constant(id.lexeme.to_string().clone())
+        } else {
+            let token = self.consume(TokenKind::Integer)?;
+            match token.lexeme.parse::<usize>() {
+                Ok(length) => ArrayLength::Literal(length),
+                Err(_) => return Err(self.error(&token, "Expecting array length")),
+            }
+        };
+        self.consume(TokenKind::RightBracket)?;
+        Ok(Type::Array(Box::new(ty), length))
+    }
+
+    // Generic arguments are types, or integers for const generic parameters.
+    fn type_argument(&mut self) -> Result<Type> {
+        if self.check(TokenKind::Integer) {
+            let token = self.consume(TokenKind::Integer)?;
+            return match token.lexeme.parse::<usize>() {
+                Ok(value) => Ok(Type::Constant(value)),
+                Err(_) => Err(self.error(&token, "Expecting constant generic argument")),
+            };
+        }
+        self.type_()
+    }
+
+    // vec[T, N] after `vec`: N lanes of the scalar type T, lowered to a
+    // single SIMD register (or a few of them) by the backend.
+    fn vector_type(&mut self) -> Result<Type> {
+        self.consume(TokenKind::LeftBracket)?;
+        let element = self.current().clone();
+        let ty = self.type_()?;
+        if !Self::is_vector_element(&ty) {
+            return Err(self.error(&element, "Expecting scalar vector element type"));
+        }
+        self.consume(TokenKind::Comma)?;
+        let lanes = self.consume(TokenKind::Integer)?;
+        let count = match lanes.lexeme.parse::<usize>() {
+            Ok(count) if count >= 2 && count <= 64 && count.is_power_of_two() => count,
+            _ => {
+                return Err(self.error(
+                    &lanes,
+                    "Expecting vector lane count to be a power of two between 2 and 64",
+                ))
+            }
+        };
+        self.consume(TokenKind::RightBracket)?;
+        Ok(Type::Vector(Box::new(ty), count))
+    }
+
+    fn is_vector_element(ty: &Type) -> bool {
+        match ty {
+            Type::Int | Type::Float => true,
+            Type::Id(name) => matches!(
+                name.as_str(),
+                "bool"
+                    | "i8"
+                    | "i16"
+                    | "i32"
+                    | "i64"
+                    | "u8"
+                    | "u16"
+                    | "u32"
+                    | "u64"
+                    | "f32"
+                    | "f64"
+            ),
+            _ => false,
+        }
+    }
+
     fn block<T>(&mut self, _parse: impl Fn(&mut Self) -> Result<T>) -> Result<Block<T>> {
         let mut ts = vec![];
         self.consume(TokenKind::Colon)?;
@@ -262,3 +592,257 @@ impl Parser {
         Error::new(message.to_string(), token.span.clone())
     }
 }
+
+#[cfg(test)]
+pub(crate) mod tests {
+    use std::sync::Arc;
+
+    use super::Parser;
+    use crate::{
+        ast::{ArrayLength, LoopHints, Statement, Type, Unroll, Vectorize},
+        error::Result,
+        span::Span,
+        tokenizer::Tokenizer,
+    };
+
+    pub(crate) fn parse(source: &str) -> Result<Vec<Statement>> {
+        let filename = Arc::new("test.velocity".to_string());
+        let tokens = Tokenizer::new(filename, source.to_string()).tokenize()?;
+        Parser::new(tokens).parse()
+    }
+
+    // Parses each (filename, source) pair, as the compiler's input files.
+    pub(crate) fn parse_files(sources: &[(&str, &str)]) -> Vec<(String, Vec<Statement>)> {
+        sources
+            .iter()
+            .map(|(filename, source)| {
+                let Ok(statements) = parse(source) else {
+                    panic!("parse failed");
+                };
+                (filename.to_string(), statements)
+            })
+            .collect()
+    }
+
+    // The span of the first token in `source` spelled `lexeme`.
+    fn span_of(source: &str, lexeme: &str) -> Span {
+        let filename = Arc::new("test.velocity".to_string());
+        let Ok(tokens) = Tokenizer::new(filename, source.to_string()).tokenize() else {
+            panic!("tokenize failed");
+        };
+        let token = tokens.iter().find(|token| token.lexeme.as_str() == lexeme);
+        token.unwrap().span.clone()
+    }
+
+    // The type of `x` in `fn f(x: <ty>)`.
+    fn type_of(ty: &str) -> Result<Type> {
+        let mut statements = parse(&format!("fn f(x: {}):\n    x\n", ty))?;
+        let Some(Statement::Function(_, mut params, ..)) = statements.pop() else {
+            panic!("expecting a function");
+        };
+        Ok(params.remove(0).ty.0)
+    }
+
+    #[test]
+    fn slice_types() {
+        let Ok(Type::Slice(element)) = type_of("[]f32") else {
+            panic!("expecting a slice");
+        };
+        assert!(matches!(*element, Type::Id(name) if name == "f32"));
+        let Ok(Type::MutableSlice(element)) = type_of("[]mut int") else {
+            panic!("expecting a mutable slice");
+        };
+        assert!(matches!(*element, Type::Int));
+        let Ok(Type::Slice(element)) = type_of("[][]mut u8") else {
+            panic!("expecting a slice");
+        };
+        assert!(matches!(*element, Type::MutableSlice(_)));
+    }
+
+    #[test]
+    fn malformed_slice_types() {
+        for ty in ["[]", "[]mut", "[", "[]mut mut f32"] {
+            assert!(type_of(ty).is_err(), "{}", ty);
+        }
+    }
+
+    #[test]
+    fn array_types() {
+        let Ok(Type::Array(element, ArrayLength::Literal(4))) = type_of("[f32; 4]") else {
+            panic!("expecting an array of 4");
+        };
+        assert!(matches!(*element, Type::Id(name) if name == "f32"));
+        let Ok(Type::Array(element, ArrayLength::Constant(length))) = type_of("[T; N]") else {
+            panic!("expecting an array of N");
+        };
+        assert!(matches!(*element, Type::Id(name) if name == "T"));
+        assert_eq!(length, "N");
+        let Ok(Type::Array(element, ArrayLength::Literal(3))) = type_of("[[int; 2]; 3]") else {
+            panic!("expecting an array of 3");
+        };
+        assert!(matches!(*element, Type::Array(_, ArrayLength::Literal(2))));
+        let Ok(Type::Polymorphic(_, args)) = type_of("Matrix[f32, 3]") else {
+            panic!("expecting a generic type");
+        };
+        assert!(matches!(args[1].0, Type::Constant(3)));
+    }
+
+    #[test]
+    fn malformed_array_types() {
+        for ty in [
+            "[f32]",
+            "[f32;]",
+            "[f32; 4",
+            "[; 4]",
+            "[f32; 4.5]",
+            "[f32; 99999999999999999999999]",
+        ] {
+            assert!(type_of(ty).is_err(), "{}", ty);
+        }
+    }
+
+    #[test]
+    fn flag_attributes_without_arguments() {
+        for attribute in ["@pure", "@cold", "@export", "@strict_math", "@pure()"] {
+            let source = format!("{}\nfn f():\n    f\n", attribute);
+            assert!(parse(&source).is_ok(), "{}", attribute);
+        }
+        for attribute in [
+            "@pure(1)",
+            "@cold(x)",
+            "@export(name)",
+            "@strict_math(nnan)",
+        ] {
+            let source = format!("{}\nfn f():\n    f\n", attribute);
+            let Err(error) = parse(&source) else {
+                panic!("expecting an error for {}", attribute);
+            };
+            let arg = &attribute[attribute.find('(').unwrap() + 1..attribute.len() - 1];
+            assert_eq!(error.span(), &span_of(&source, arg));
+        }
+        let source = "fn f():\n    @no_vectorize(4)\n    for i in 0..4:\n        i\n";
+        assert!(parse(source).is_err());
+    }
+
+    // The hints `attributes` give a loop.
+    fn hints(attributes: &str) -> Result<LoopHints> {
+        let mut source = "fn f():\n".to_string();
+        if !attributes.is_empty() {
+            source += &format!("    {}\n", attributes);
+        }
+        source += "    for i in 0..8:\n        i\n";
+        let statements = parse(&source)?;
+        let Statement::Function(_, _, _, body, ..) = &statements[0] else {
+            panic!("expecting a function");
+        };
+        let Statement::For(.., hints) = &body.ts[0] else {
+            panic!("expecting a loop");
+        };
+        Ok(hints.clone())
+    }
+
+    #[test]
+    fn loop_hints() {
+        let Ok(none) = hints("") else {
+            panic!("parse failed");
+        };
+        assert!(none.unroll.is_none() && none.vectorize.is_none());
+        let Ok(full) = hints("@unroll") else {
+            panic!("parse failed");
+        };
+        assert!(matches!(full.unroll, Some(Unroll::Full)));
+        let Ok(both) = hints("@unroll(4)\n    @vectorize(8)") else {
+            panic!("parse failed");
+        };
+        assert!(matches!(both.unroll, Some(Unroll::Times(4))));
+        assert!(matches!(both.vectorize, Some(Vectorize::Width(Some(8)))));
+        let Ok(any_width) = hints("@vectorize") else {
+            panic!("parse failed");
+        };
+        assert!(matches!(any_width.vectorize, Some(Vectorize::Width(None))));
+        let Ok(never) = hints("@no_vectorize @unroll(2)") else {
+            panic!("parse failed");
+        };
+        assert!(matches!(never.vectorize, Some(Vectorize::Never)));
+        assert!(matches!(never.unroll, Some(Unroll::Times(2))));
+    }
+
+    #[test]
+    fn invalid_loop_hints() {
+        for attributes in [
+            "@unroll(0)",
+            "@unroll(n)",
+            "@unroll(2, 4)",
+            "@vectorize(3)",
+            "@vectorize(128)",
+            "@vectorize @no_vectorize",
+            "@pure",
+            "@inline",
+        ] {
+            assert!(hints(attributes).is_err(), "{}", attributes);
+        }
+    }
+
+    #[test]
+    fn duplicate_attributes() {
+        let source = "fn f():\n    @unroll(2)\n    @unroll(8)\n    for i in 0..8:\n        i\n";
+        let Err(error) = parse(source) else {
+            panic!("expecting an error");
+        };
+        assert_eq!(error.span().1.start.0, 3);
+        assert!(parse("@cold\n@cold\nfn f():\n    f\n").is_err());
+        assert!(hints("@vectorize(4) @vectorize(4)").is_err());
+    }
+
+    #[test]
+    fn vector_types() {
+        assert!(parse("fn f(x: vec[f32, 4]):\n    x\n").is_ok());
+        assert!(parse("fn f(x: vec[u8, 16]):\n    x\n").is_ok());
+    }
+
+    #[test]
+    fn vec_as_identifier() {
+        let source = concat!(
+            "struct Buffer:\n",
+            "    vec: int\n",
+            "\n",
+            "fn vec(vec: vec[f32, 4], other: vec):\n",
+            "    for vec in 0..4:\n",
+            "        vec\n",
+            "    vec\n",
+        );
+        let Ok(statements) = parse(source) else {
+            panic!("parse failed");
+        };
+        let Statement::Function(_, params, ..) = &statements[1] else {
+            panic!("expecting a function");
+        };
+        assert!(matches!(params[0].ty.0, Type::Vector(..)));
+        assert!(matches!(&params[1].ty.0, Type::Id(name) if name == "vec"));
+    }
+
+    #[test]
+    fn vector_type_without_element_type() {
+        let source = "fn f(x: vec[5, 4]):\n    x\n";
+        let Err(error) = parse(source) else {
+            panic!("expecting an error");
+        };
+        assert_eq!(error.span(), &span_of(source, "5"));
+    }
+
+    #[test]
+    fn malformed_vector_types() {
+        for ty in [
+            "vec[]",
+            "vec[, 4]",
+            "vec[f32]",
+            "vec[f32, 3]",
+            "vec[f32, 128]",
+            "vec[Point, 4]",
+            "vec[vec[f32, 4], 4]",
+        ] {
+            let source = format!("fn f(x: {}):\n    x\n", ty);
+            assert!(parse(&source).is_err(), "{}", ty);
+        }
+    }
+}
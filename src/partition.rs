@@ -0,0 +1,179 @@
+use std::collections::HashMap;
+
+use crate::{
+    ast::{Expression, Statement},
+    reachability,
+};
+
+// Largest callee, in syntax tree nodes, that a unit copies from another
+// unit so it can be inlined there. Callees referenced inside a loop may be
+// `HOT_MULTIPLIER` times larger, as with LLVM's -import-instr-limit and
+// -import-hot-multiplier.
+const IMPORT_LIMIT: usize = 40;
+const HOT_MULTIPLIER: usize = 10;
+
+// A group of functions compiled to one object file, independently of and
+// in parallel with the other units. `imports` are functions defined in
+// other units that this unit also compiles a private copy of, so calls to
+// them can still be inlined across the split.
+pub(crate) struct CodegenUnit {
+    pub(crate) functions: Vec<(usize, String)>,
+    pub(crate) imports: Vec<(usize, String)>,
+}
+
+// Splits the functions of `files` into at most `units` codegen units. Each
+// file starts as its own unit and the two smallest are merged until few
+// enough remain. Files are never split, so each unit is a set of whole
+// files, as with per-module ThinLTO.
+pub(crate) fn partition(files: &[(String, Vec<Statement>)], units: usize) -> Vec<CodegenUnit> {
+    let mut sizes: HashMap<(usize, String), usize> = HashMap::new();
+    let mut groups: Vec<(usize, Vec<(usize, String)>)> = vec![];
+    for (index, (_, statements)) in files.iter().enumerate() {
+        let mut group = (0, vec![]);
+        for statement in statements {
+            if let Statement::Function(name, _, _, body, ..) = statement {
+                let size = size(&body.ts);
+                sizes.insert((index, name.0.clone()), size);
+                group.0 += size;
+                group.1.push((index, name.0.clone()));
+            }
+        }
+        if !group.1.is_empty() {
+            groups.push(group);
+        }
+    }
+    while groups.len() > units.max(1) {
+        // Largest first, ties broken by position, so the two smallest are
+        // at the end.
+        groups.sort_by(|a, b| b.0.cmp(&a.0).then(a.1.cmp(&b.1)));
+        let (size, functions) = groups.pop().unwrap();
+        let last = groups.last_mut().unwrap();
+        last.0 += size;
+        last.1.extend(functions);
+        // Stable, so each file's functions stay in source order.
+        last.1.sort_by_key(|(index, _)| *index);
+    }
+    groups.sort_by(|a, b| a.1.cmp(&b.1));
+
+    let modules = reachability::modules(files);
+    let unit_of: HashMap<&(usize, String), usize> = groups
+        .iter()
+        .enumerate()
+        .flat_map(|(unit, (_, functions))| functions.iter().map(move |function| (function, unit)))
+        .collect();
+    groups
+        .iter()
+        .enumerate()
+        .map(|(unit, (_, functions))| {
+            let mut imports = vec![];
+            for (index, name) in functions {
+                let body = reachability::function_body(&files[*index].1, name).unwrap();
+                for call in reachability::call_sites(files, &modules, *index, body) {
+                    let limit = if call.in_loop {
+                        IMPORT_LIMIT * HOT_MULTIPLIER
+                    } else {
+                        IMPORT_LIMIT
+                    };
+                    if unit_of[&call.callee] != unit && sizes[&call.callee] <= limit {
+                        imports.push(call.callee);
+                    }
+                }
+            }
+            imports.sort();
+            imports.dedup();
+            CodegenUnit {
+                functions: functions.clone(),
+                imports,
+            }
+        })
+        .collect()
+}
+
+// The number of statements and expressions in a function body, a rough
+// stand-in for how much code it compiles to.
+fn size(statements: &[Statement]) -> usize {
+    statements
+        .iter()
+        .map(|statement| match statement {
+            Statement::Function(_, _, _, body, ..) => 1 + size(&body.ts),
+            Statement::For(_, iterable, body, _) => 1 + expression_size(iterable) + size(&body.ts),
+            Statement::Expression(expr) => expression_size(expr),
+            Statement::Import(..) | Statement::Struct(..) => 1,
+        })
+        .sum()
+}
+
+fn expression_size(expr: &Expression) -> usize {
+    match expr {
+        Expression::Identifier(_) | Expression::Integer(_) | Expression::String(_) => 1,
+        Expression::Range(start, end) => 1 + expression_size(&start.0) + expression_size(&end.0),
+        Expression::Call(callee, args) => {
+            1 + expression_size(&callee.0)
+                + args
+                    .iter()
+                    .map(|(arg, _)| expression_size(arg))
+                    .sum::<usize>()
+        }
+        Expression::Access(base, member) => {
+            1 + expression_size(&base.0) + expression_size(&member.0)
+        }
+        Expression::Await(expr)
+        | Expression::Reference(expr)
+        | Expression::MutableReference(expr) => 1 + expression_size(&expr.0),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{partition, CodegenUnit, IMPORT_LIMIT};
+    use crate::{ast::Statement, parser::tests::parse_files};
+
+    // main calls a one-node function and one too large to import, from
+    // inside a loop when `hot`.
+    fn program(hot: bool) -> Vec<(String, Vec<Statement>)> {
+        let main = if hot {
+            "import util\nimport big\n\nfn main():\n    util.small(1)\n    for i in 0..4:\n        big.large(i)\n"
+        } else {
+            "import util\nimport big\n\nfn main():\n    util.small(1)\n    big.large(1)\n"
+        };
+        let large = format!("fn large(n: int):\n{}", "    n\n".repeat(IMPORT_LIMIT + 1));
+        parse_files(&[
+            ("main.velocity", main),
+            ("util.velocity", "fn small(n: int):\n    n\n"),
+            ("big.velocity", &large),
+            ("types.velocity", "struct Point:\n    x: int\n"),
+        ])
+    }
+
+    fn names(functions: &[(usize, String)]) -> Vec<&str> {
+        functions.iter().map(|(_, name)| name.as_str()).collect()
+    }
+
+    fn functions(units: &[CodegenUnit]) -> Vec<Vec<&str>> {
+        units.iter().map(|unit| names(&unit.functions)).collect()
+    }
+
+    #[test]
+    fn one_unit_per_file() {
+        let units = partition(&program(false), 8);
+        assert_eq!(functions(&units), [["main"], ["small"], ["large"]]);
+        assert_eq!(names(&units[0].imports), ["small"]);
+        assert!(units[1].imports.is_empty() && units[2].imports.is_empty());
+    }
+
+    #[test]
+    fn hot_callees_are_imported() {
+        let units = partition(&program(true), 8);
+        assert_eq!(names(&units[0].imports), ["small", "large"]);
+    }
+
+    #[test]
+    fn merges_smallest_units() {
+        let units = partition(&program(false), 2);
+        assert_eq!(functions(&units), [vec!["main", "small"], vec!["large"]]);
+        assert!(units[0].imports.is_empty() && units[1].imports.is_empty());
+        let units = partition(&program(true), 1);
+        assert_eq!(functions(&units), [["main", "small", "large"]]);
+        assert!(units[0].imports.is_empty());
+    }
+}
@@ -0,0 +1,303 @@
+use std::{
+    collections::{HashMap, HashSet},
+    path::Path,
+};
+
+use crate::ast::{Expression, Statement};
+
+// Finds the top-level functions a program can reach, rooted at `main` and
+// at functions marked @export. `files` holds each input file's name and
+// statements; a function is identified by its file's index and its name.
+// A module-qualified reference such as `math.sqrt` resolves through the
+// file's imports to the input file whose stem matches the import path's
+// last component, so std only costs what the program uses when its files
+// are compiled alongside it.
+//
+// Returns None when nothing is a root, as when compiling a library on its
+// own, in which case every function is kept.
+pub(crate) fn reachable(files: &[(String, Vec<Statement>)]) -> Option<HashSet<(usize, String)>> {
+    let modules = modules(files);
+
+    let mut worklist: Vec<(usize, String)> = vec![];
+    for (index, (_, statements)) in files.iter().enumerate() {
+        for statement in statements {
+            if let Statement::Function(name, _, _, _, _, attributes) = statement {
+                if name.0 == "main" || attributes.iter().any(|a| a.name.0 == "export") {
+                    worklist.push((index, name.0.clone()));
+                }
+            }
+        }
+    }
+    if worklist.is_empty() {
+        return None;
+    }
+
+    let mut reachable = HashSet::new();
+    while let Some((index, name)) = worklist.pop() {
+        let Some(body) = function_body(&files[index].1, &name) else {
+            continue;
+        };
+        if !reachable.insert((index, name)) {
+            continue;
+        }
+        let calls = call_sites(files, &modules, index, body);
+        worklist.extend(calls.into_iter().map(|call| call.callee));
+    }
+    Some(reachable)
+}
+
+// A reference from one function to another, which is a call or a function
+// value, and whether it happens inside a loop.
+pub(crate) struct CallSite {
+    pub(crate) callee: (usize, String),
+    pub(crate) in_loop: bool,
+}
+
+// The functions `body`, from file `index`, refers to. `modules` comes from
+// `modules(files)`.
+pub(crate) fn call_sites(
+    files: &[(String, Vec<Statement>)],
+    modules: &[HashMap<String, usize>],
+    index: usize,
+    body: &[Statement],
+) -> Vec<CallSite> {
+    let mut walker = Walker {
+        file: index,
+        statements: &files[index].1,
+        modules: &modules[index],
+        files,
+        loops: 0,
+        found: vec![],
+    };
+    walker.statements(body);
+    walker.found
+}
+
+// Each file's imports, by the local name they're imported as.
+pub(crate) fn modules(files: &[(String, Vec<Statement>)]) -> Vec<HashMap<String, usize>> {
+    let stems: Vec<String> = files
+        .iter()
+        .map(|(filename, _)| {
+            Path::new(filename)
+                .file_stem()
+                .map_or(filename.clone(), |stem| stem.to_string_lossy().to_string())
+        })
+        .collect();
+    files
+        .iter()
+        .map(|(_, statements)| imports(statements, &stems))
+        .collect()
+}
+
+// Maps each import's local name to the input file it refers to, skipping
+// imports of modules that weren't given to the compiler.
+fn imports(statements: &[Statement], stems: &[String]) -> HashMap<String, usize> {
+    let mut modules = HashMap::new();
+    for statement in statements {
+        if let Statement::Import(path, alias) = statement {
+            let module = path.0.rsplit('/').next().unwrap();
+            let name = alias.as_ref().map_or(module, |alias| alias.0.as_str());
+            if let Some(index) = stems.iter().position(|stem| stem == module) {
+                modules.insert(name.to_string(), index);
+            }
+        }
+    }
+    modules
+}
+
+pub(crate) fn function_body<'a>(
+    statements: &'a [Statement],
+    name: &str,
+) -> Option<&'a [Statement]> {
+    statements.iter().find_map(|statement| match statement {
+        Statement::Function(function, _, _, body, ..) if function.0 == name => Some(&body.ts[..]),
+        _ => None,
+    })
+}
+
+struct Walker<'a> {
+    file: usize,
+    statements: &'a [Statement],
+    modules: &'a HashMap<String, usize>,
+    files: &'a [(String, Vec<Statement>)],
+    loops: usize,
+    found: Vec<CallSite>,
+}
+
+impl Walker<'_> {
+    fn statements(&mut self, statements: &[Statement]) {
+        for statement in statements {
+            match statement {
+                Statement::Function(_, _, _, body, ..) => self.statements(&body.ts),
+                Statement::For(_, iterable, body, _) => {
+                    self.expression(iterable);
+                    self.loops += 1;
+                    self.statements(&body.ts);
+                    self.loops -= 1;
+                }
+                Statement::Expression(expr) => self.expression(expr),
+                Statement::Import(..) | Statement::Struct(..) => {}
+            }
+        }
+    }
+
+    fn expression(&mut self, expr: &Expression) {
+        match expr {
+            // Calls and function values alike.
+            Expression::Identifier((name, _)) => {
+                if function_body(self.statements, name).is_some() {
+                    self.found(self.file, name);
+                }
+            }
+            Expression::Integer(_) | Expression::String(_) => {}
+            Expression::Range(start, end) => {
+                self.expression(&start.0);
+                self.expression(&end.0);
+            }
+            Expression::Call(callee, args) => {
+                self.expression(&callee.0);
+                for (arg, _) in args {
+                    self.expression(arg);
+                }
+            }
+            Expression::Access(base, member) => {
+                if let Expression::Identifier((module, _)) = &*base.0 {
+                    if let Some(&index) = self.modules.get(module) {
+                        self.qualified(index, &member.0);
+                        return;
+                    }
+                }
+                self.expression(&base.0);
+                self.member(&member.0);
+            }
+            Expression::Await(expr)
+            | Expression::Reference(expr)
+            | Expression::MutableReference(expr) => self.expression(&expr.0),
+        }
+    }
+
+    // `module.f` or `module.f(args)`.
+    fn qualified(&mut self, index: usize, member: &Expression) {
+        let name = match member {
+            Expression::Identifier((name, _)) => name,
+            Expression::Call(callee, args) => {
+                for (arg, _) in args {
+                    self.expression(arg);
+                }
+                match &*callee.0 {
+                    Expression::Identifier((name, _)) => name,
+                    _ => return,
+                }
+            }
+            _ => return self.member(member),
+        };
+        if function_body(&self.files[index].1, name).is_some() {
+            self.found(index, name);
+        }
+    }
+
+    fn found(&mut self, index: usize, name: &str) {
+        self.found.push(CallSite {
+            callee: (index, name.to_string()),
+            in_loop: self.loops > 0,
+        });
+    }
+
+    // Member names are fields or methods, not functions in scope; only the
+    // arguments of a method call can reach anything.
+    fn member(&mut self, member: &Expression) {
+        match member {
+            Expression::Identifier(_) => {}
+            Expression::Call(_, args) => {
+                for (arg, _) in args {
+                    self.expression(arg);
+                }
+            }
+            Expression::Access(base, member) => {
+                self.member(&base.0);
+                self.member(&member.0);
+            }
+            _ => self.expression(member),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashSet;
+
+    use super::reachable;
+    use crate::parser::tests::parse_files;
+
+    fn names(reachable: &HashSet<(usize, String)>) -> Vec<String> {
+        let mut names: Vec<String> = reachable
+            .iter()
+            .map(|(file, name)| format!("{}:{}", file, name))
+            .collect();
+        names.sort();
+        names
+    }
+
+    #[test]
+    fn prunes_unreachable_functions() {
+        let files = parse_files(&[
+            (
+                "main.velocity",
+                concat!(
+                    "import lib/geometry as g\n",
+                    "\n",
+                    "fn main():\n",
+                    "    helper()\n",
+                    "\n",
+                    "fn helper():\n",
+                    "    for i in 0..4:\n",
+                    "        g.area(i)\n",
+                    "\n",
+                    "fn unused():\n",
+                    "    helper()\n",
+                ),
+            ),
+            (
+                "geometry.velocity",
+                concat!(
+                    "fn area(n: int):\n",
+                    "    square(n)\n",
+                    "\n",
+                    "fn square(n: int):\n",
+                    "    n\n",
+                    "\n",
+                    "fn perimeter(n: int):\n",
+                    "    n\n",
+                    "\n",
+                    "@export\n",
+                    "fn exported():\n",
+                    "    apply(perimeter)\n",
+                    "\n",
+                    "fn apply(f: int):\n",
+                    "    f\n",
+                ),
+            ),
+        ]);
+        let Some(reachable) = reachable(&files) else {
+            panic!("expecting roots");
+        };
+        assert_eq!(
+            names(&reachable),
+            [
+                "0:helper",
+                "0:main",
+                "1:apply",
+                "1:area",
+                "1:exported",
+                "1:perimeter",
+                "1:square"
+            ]
+        );
+    }
+
+    #[test]
+    fn keeps_everything_without_roots() {
+        let files = parse_files(&[("lib.velocity", "fn f():\n    g()\n\nfn g():\n    f\n")]);
+        assert!(reachable(&files).is_none());
+    }
+}
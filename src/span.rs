@@ -1,6 +1,6 @@
-use std::{ops::Range, rc::Rc};
+use std::{ops::Range, sync::Arc};
 
-pub(crate) type Span = (Rc<String>, Range<(usize, usize)>); // (filename, range<line, start/end>)
+pub(crate) type Span = (Arc<String>, Range<(usize, usize)>); // (filename, range<line, start/end>)
 pub(crate) type Spanned<T> = (T, Span);
 
 pub(crate) fn spanned<T>(t: T, span: Span) -> Spanned<T> {
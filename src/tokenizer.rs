@@ -1,6 +1,6 @@
 use crate::error::{Error, Result};
 use crate::span::Span;
-use std::rc::Rc;
+use std::sync::Arc;
 
 #[derive(Debug, Clone, PartialEq)]
 pub(crate) enum TokenKind {
@@ -11,6 +11,8 @@ pub(crate) enum TokenKind {
     Floating,   // 123.456, 123.456e+2, 123.456e-2, -123.456
     // keywords
     As,     // as
+    Async,  // async
+    Await,  // await
     Const,  // const
     Fn,     // fn
     For,    // for
@@ -32,9 +34,11 @@ pub(crate) enum TokenKind {
     RightBracket,     // ]
     Comma,            // ,
     Dot,              // .
+    DotDot,           // ..
     Colon,            // :
-    // Semicolon,        // ;
-    ThinArrow, // ->
+    Semicolon,        // ; (only inside brackets, as in [T; N])
+    At,               // @
+    ThinArrow,        // ->
     // operators
     Plus,              // +
     PlusEquals,        // +=
@@ -72,39 +76,43 @@ pub(crate) enum TokenKind {
 #[derive(Debug, Clone)]
 pub(crate) struct Token {
     pub(crate) kind: TokenKind,
-    pub(crate) lexeme: Rc<String>,
+    pub(crate) lexeme: Arc<String>,
     pub(crate) span: Span,
 }
 
 impl Token {
-    pub(crate) fn new(kind: TokenKind, lexeme: Rc<String>, span: Span) -> Token {
+    pub(crate) fn new(kind: TokenKind, lexeme: Arc<String>, span: Span) -> Token {
         Token { kind, lexeme, span }
     }
 }
 
 pub(crate) struct Tokenizer {
-    filename: Rc<String>,
-    contents: Rc<String>,
+    filename: Arc<String>,
+    contents: Arc<String>,
     index: usize,
     line: usize,
     column: usize,
     indent_stack: Vec<(usize, bool)>, // (indent, continuation)
+    pending_dedents: usize,           // blocks closed by the last line beyond the first
+    bracket_depth: usize,
 }
 
 impl Tokenizer {
-    pub(crate) fn new(filename: Rc<String>, contents: String) -> Tokenizer {
+    pub(crate) fn new(filename: Arc<String>, contents: String) -> Tokenizer {
         Tokenizer {
             filename,
-            contents: Rc::new(contents.clone()),
+            contents: Arc::new(contents.clone()),
             index: 0,
             line: 1,
             column: 1,
             indent_stack: vec![(0, false)],
+            pending_dedents: 0,
+            bracket_depth: 0,
         }
     }
 
     fn single_token(&mut self, kind: TokenKind) -> Result<Token> {
-        let token = Token::new(kind, Rc::new("".to_string()), self.construct_span(1));
+        let token = Token::new(kind, Arc::new("".to_string()), self.construct_span(1));
         self.index += 1;
         self.column += 1;
         Ok(token)
@@ -124,11 +132,11 @@ impl Tokenizer {
             self.column += 1;
             Token::new(
                 kind_2,
-                Rc::new(format!("{}{}", char_1, char_2)),
+                Arc::new(format!("{}{}", char_1, char_2)),
                 self.construct_span(2),
             )
         } else {
-            Token::new(kind_1, Rc::new(char_1.to_string()), self.construct_span(1))
+            Token::new(kind_1, Arc::new(char_1.to_string()), self.construct_span(1))
         };
         Ok(token)
     }
@@ -161,10 +169,18 @@ impl Tokenizer {
     }
 
     fn next_token(&mut self) -> Result<Token> {
+        if self.pending_dedents > 0 {
+            self.pending_dedents -= 1;
+            return Ok(Token::new(
+                TokenKind::Dedent,
+                Arc::new("".to_string()),
+                self.construct_span(1),
+            ));
+        }
         if let None = self.current() {
             return Ok(Token::new(
                 TokenKind::Eof,
-                Rc::new("".to_string()),
+                Arc::new("".to_string()),
                 self.construct_span(0),
             ));
         }
@@ -216,21 +232,22 @@ impl Tokenizer {
                     self.indent_stack.push((indent, continuation));
                     Ok(Token::new(
                         TokenKind::Indent,
-                        Rc::new("".to_string()),
+                        Arc::new("".to_string()),
                         self.construct_span(1),
                     ))
                 } else if indent < *prev_indent {
-                    self.indent_stack.pop();
-                    if let Some((prev_indent, _)) = self.indent_stack.last() {
-                        if indent < *prev_indent {
-                            return Err(
-                                self.error("inconsistent indentation", self.construct_span(1))
-                            );
-                        }
+                    // one line can close several nested blocks at once
+                    while indent < self.indent_stack.last().unwrap().0 {
+                        self.indent_stack.pop();
+                        self.pending_dedents += 1;
+                    }
+                    self.pending_dedents -= 1;
+                    if indent > self.indent_stack.last().unwrap().0 {
+                        return Err(self.error("inconsistent indentation", self.construct_span(1)));
                     }
                     Ok(Token::new(
                         TokenKind::Dedent,
-                        Rc::new("".to_string()),
+                        Arc::new("".to_string()),
                         self.construct_span(1),
                     ))
                 } else {
@@ -239,7 +256,7 @@ impl Tokenizer {
                     }
                     Ok(Token::new(
                         TokenKind::Linefeed,
-                        Rc::new("".to_string()),
+                        Arc::new("".to_string()),
                         self.construct_span(1),
                     ))
                 }
@@ -260,6 +277,8 @@ impl Tokenizer {
                 }
                 let kind = match value.as_str() {
                     "as" => TokenKind::As,
+                    "async" => TokenKind::Async,
+                    "await" => TokenKind::Await,
                     "const" => TokenKind::Const,
                     "fn" => TokenKind::Fn,
                     "for" => TokenKind::For,
@@ -275,7 +294,7 @@ impl Tokenizer {
                 };
                 Ok(Token::new(
                     kind,
-                    Rc::new(value.clone()),
+                    Arc::new(value.clone()),
                     self.construct_span(value.len()),
                 ))
             }
@@ -290,6 +309,10 @@ impl Tokenizer {
                             self.index += 1;
                             self.column += 1;
                         }
+                        // `0..n` is a range, not the float `0.`
+                        Some('.') if self.contents.chars().nth(self.index + 1) == Some('.') => {
+                            break
+                        }
                         Some('.') => {
                             value.push(self.current().unwrap());
                             self.index += 1;
@@ -340,7 +363,7 @@ impl Tokenizer {
                 };
                 Ok(Token::new(
                     kind,
-                    Rc::new(value.clone()),
+                    Arc::new(value.clone()),
                     self.construct_span(value.len()),
                 ))
             }
@@ -402,7 +425,7 @@ impl Tokenizer {
                 }
                 Ok(Token::new(
                     TokenKind::String,
-                    Rc::new(value.clone()),
+                    Arc::new(value.clone()),
                     self.construct_span(value.len() + 2),
                 ))
             }
@@ -411,11 +434,19 @@ impl Tokenizer {
             ')' => self.single_token(TokenKind::RightParenthesis),
             '{' => self.single_token(TokenKind::LeftBrace),
             '}' => self.single_token(TokenKind::RightBrace),
-            '[' => self.single_token(TokenKind::LeftBracket),
-            ']' => self.single_token(TokenKind::RightBracket),
+            '[' => {
+                self.bracket_depth += 1;
+                self.single_token(TokenKind::LeftBracket)
+            }
+            ']' => {
+                self.bracket_depth = self.bracket_depth.saturating_sub(1);
+                self.single_token(TokenKind::RightBracket)
+            }
             ',' => self.single_token(TokenKind::Comma),
-            '.' => self.single_token(TokenKind::Dot),
+            '.' => self.double_token('.', TokenKind::Dot, '.', TokenKind::DotDot),
             ':' => self.single_token(TokenKind::Colon),
+            '@' => self.single_token(TokenKind::At),
+            ';' if self.bracket_depth > 0 => self.single_token(TokenKind::Semicolon),
             ';' => Err(self.error(
                 "semicolon isn't used as a statement terminator",
                 self.construct_span(1),
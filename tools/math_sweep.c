@@ -0,0 +1,105 @@
+// Measures the maximum error of std/math's single-precision sinf and cosf
+// over every f32 in |x| <= pi and |x| <= 100, against the platform's
+// double-precision sin and cos. The functions below mirror reduce_pio4,
+// sin_kernel, cos_kernel, vsin and vcos in std/math.vc one lane at a time,
+// so keep them in step with it and update the table there from the output.
+//
+//     cc -O2 -ffp-contract=off -o math_sweep tools/math_sweep.c -lm
+//     ./math_sweep
+//
+// -ffp-contract=off keeps the compiler from fusing multiplies and adds the
+// std kernels evaluate separately. A full run takes about ten minutes.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const float FOUR_OVER_PI = 1.27323954473516f;
+static const float PIO4_1 = 0.78515625f;
+static const float PIO4_2 = 2.4187564849853515625e-4f;
+static const float PIO4_3 = 3.77489497744594108e-8f;
+static const int32_t SIGN_BIT = INT32_MIN;
+
+static float sin_kernel(float r) {
+    float z = r * r;
+    float p = z * -1.9515295891e-4f + 8.3321608736e-3f;
+    p = p * z - 1.6666654611e-1f;
+    return p * z * r + r;
+}
+
+static float cos_kernel(float r) {
+    float z = r * r;
+    float p = z * 2.443315711809948e-5f - 1.388731625493765e-3f;
+    p = p * z + 4.166664568298827e-2f;
+    return p * z * z - z * 0.5f + 1.0f;
+}
+
+static int32_t to_bits(float f) {
+    int32_t i;
+    memcpy(&i, &f, sizeof i);
+    return i;
+}
+
+static float from_bits(int32_t i) {
+    float f;
+    memcpy(&f, &i, sizeof f);
+    return f;
+}
+
+// |x| reduced to [-pi/4, pi/4], and the even octant it was reduced from.
+static float reduce_pio4(float x, int32_t *octant) {
+    float ax = fabsf(x);
+    int32_t j = ((int32_t)(ax * FOUR_OVER_PI) + 1) & ~1;
+    float y = (float)j;
+    *octant = j & 7;
+    return ((ax - y * PIO4_1) - y * PIO4_2) - y * PIO4_3;
+}
+
+static float sinf_std(float x) {
+    int32_t j;
+    float r = reduce_pio4(x, &j);
+    int32_t flip = (j & 4) << 29;
+    float p = (j & 2) ? cos_kernel(r) : sin_kernel(r);
+    return from_bits(to_bits(p) ^ (to_bits(x) & SIGN_BIT) ^ flip);
+}
+
+static float cosf_std(float x) {
+    int32_t j;
+    float r = reduce_pio4(x, &j);
+    int32_t flip = (int32_t)((uint32_t)(((j >> 1) ^ (j >> 2)) & 1) << 31);
+    float p = (j & 2) == 0 ? cos_kernel(r) : sin_kernel(r);
+    return from_bits(to_bits(p) ^ flip);
+}
+
+// |got - want| in units of the last place of `want` as an f32.
+static double ulp_error(float got, double want) {
+    int exponent;
+    frexp(want, &exponent);
+    double ulp = ldexp(1.0, exponent - 24 < -149 ? -149 : exponent - 24);
+    return fabs(got - want) / ulp;
+}
+
+static void sweep(const char *name, float (*f)(float), double (*reference)(double),
+                  float limit) {
+    double worst = 0;
+    float at = 0;
+    for (float x = -limit; x <= limit; x = nextafterf(x, INFINITY)) {
+        double error = ulp_error(f(x), reference(x));
+        if (error > worst) {
+            worst = error;
+            at = x;
+        }
+    }
+    printf("%s |x| <= %g: %.2f ULP at %.9g\n", name, limit, worst, at);
+    fflush(stdout);
+}
+
+int main(void) {
+    const float limits[] = {3.14159265f, 100.0f};
+    for (int i = 0; i < 2; i++) {
+        sweep("sinf", sinf_std, sin, limits[i]);
+        sweep("cosf", cosf_std, cos, limits[i]);
+    }
+    return 0;
+}